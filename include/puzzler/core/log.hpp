@@ -53,7 +53,7 @@ namespace puzzler
       if(level <= m_logLevel){
         std::stringstream tmp;
         f(tmp);
-        Log(level, tmp.str().c_str());
+        Log(level, "%s", tmp.str().c_str());
       }
     }
 
@@ -121,9 +121,13 @@ namespace puzzler
     {
       std::vector<char> tmp(2000, 0);
 
-      unsigned n=vsnprintf(&tmp[0], tmp.size(), str, args);
-      if(n>tmp.size()){
-        tmp.resize(n);
+      // args can only be walked once, so the first attempt uses a copy
+      va_list first;
+      va_copy(first, args);
+      unsigned n=vsnprintf(&tmp[0], tmp.size(), str, first);
+      va_end(first);
+      if(n>=tmp.size()){
+        tmp.resize(n+1);
         vsnprintf(&tmp[0], tmp.size(), str, args);
       }
 
@@ -0,0 +1,79 @@
+#ifndef  puzzler_core_streams_file_out_hpp
+#define  puzzler_core_streams_file_out_hpp
+
+#include "puzzler/core/stream.hpp"
+
+namespace puzzler{
+
+  class FileOutStream
+    : public Stream
+  {
+  private:
+    // No implementation for either
+    FileOutStream(const FileOutStream &); // = delete;
+    FileOutStream &operator=(const FileOutStream &); // = delete;
+
+    uint64_t m_offset;
+
+    int m_fd;
+  public:
+    FileOutStream(std::string path)
+      : m_offset(0)
+      , m_fd(-1)
+    {
+      m_fd=open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+      if(m_fd==-1)
+        throw std::runtime_error("FileOutStream - Couldn't open file '"+path+"'");
+    }
+
+    //! Write to a file that is already open, such as one from mkstemp; fd is closed with the stream
+    explicit FileOutStream(int fd)
+      : m_offset(0)
+      , m_fd(fd)
+    {}
+
+    ~FileOutStream()
+    {
+      if(m_fd!=-1){
+        close(m_fd);
+        m_fd=-1;
+      }
+    }
+
+    virtual void Send(size_t cbData, const void *pData)
+    {
+      do{
+        int sent=write(m_fd, pData, cbData);
+        if(sent==0)
+          throw std::runtime_error("FileOutStream::Send - No data was written.");
+        if(sent<0)
+          throw std::runtime_error("FileOutStream::Send - Error while writing");
+        m_offset+=sent;
+        cbData-=sent;
+        pData=sent+(uint8_t*)pData;
+      }while(cbData>0);
+    }
+
+    //! Wait until everything sent is on the disk
+    void Sync()
+    {
+      if(fsync(m_fd)!=0)
+        throw std::runtime_error("FileOutStream::Sync - Error while syncing");
+    }
+
+    virtual void Recv(size_t , void *)
+    {
+      throw std::runtime_error("FileOutStream::Recv - no such operation.");
+    }
+
+    //! Return the current offset from some arbitrary starting point
+    virtual uint64_t SendOffset() const
+    { return m_offset; }
+
+    virtual uint64_t RecvOffset() const
+    { return 0; }
+  };
+
+}; // puzzler
+
+#endif
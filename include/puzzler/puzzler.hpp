@@ -5,5 +5,6 @@
 #include "puzzler/core/streams/stdin_stream.hpp"
 #include "puzzler/core/streams/stdout_stream.hpp"
 #include "puzzler/core/streams/file_in_stream.hpp"
+#include "puzzler/core/streams/file_out_stream.hpp"
 
 #endif
@@ -1,8 +1,10 @@
 #ifndef puzzler_puzzles_circuit_sim_hpp
 #define puzzler_puzzles_circuit_sim_hpp
 
+#include <algorithm>
 #include <random>
 #include <sstream>
+#include <thread>
 
 #include "puzzler/core/puzzle.hpp"
 
@@ -96,6 +98,21 @@ namespace puzzler
   {
   protected:
 
+    //! Map 32 random bits onto [0,n) without a division
+    static unsigned uniform(uint64_t r, unsigned n)
+    {
+      return unsigned(((r&0xFFFFFFFFull)*n)>>32);
+    }
+
+    //! splitmix64 finaliser over (seed,index), for order-independent streams
+    static uint64_t mix(uint64_t seed, uint64_t index)
+    {
+      uint64_t z=seed + (index+1)*0x9E3779B97F4A7C15ull;
+      z=(z^(z>>30))*0xBF58476D1CE4E5B9ull;
+      z=(z^(z>>27))*0x94D049BB133111EBull;
+      return z^(z>>31);
+    }
+
     bool calcSrc(unsigned src, const std::vector<bool> &state, const CircuitSimInput *input) const
     {
       if(src < input->flipFlopCount){
@@ -157,12 +174,29 @@ namespace puzzler
     { return "circuit_sim"; }
 
     virtual std::shared_ptr<Input> CreateInput(
-					       ILog *,
+					       ILog *log,
 					       int scale
 					       ) const override
     {
-      std::mt19937 rnd(time(0));  // Not the best way of seeding...
+      return CreateInput(log, scale, time(0));  // Not the best way of seeding...
+    }
 
+    /*! Create a random circuit that is a pure function of seed.
+
+      Gates are wired up in a random order, each taking both inputs from
+      the flip-flops and gates already wired, which keeps the circuit
+      acyclic. The order is a Fisher-Yates shuffle and each gate's sources
+      come from a counter-based generator keyed on (seed, position), so
+      generation is O(n) and the gate loop can be split across threads
+      without changing the result.
+    */
+    std::shared_ptr<CircuitSimInput> CreateInput(
+						 ILog *log,
+						 int scale,
+						 uint64_t seed,
+						 unsigned threads=1
+						 ) const
+    {
       auto params=std::make_shared<CircuitSimInput>(this, scale);
 
       params->clockCycles=scale;
@@ -172,38 +206,50 @@ namespace puzzler
       params->nandGateInputs.resize(params->nandGateCount);
       params->flipFlopInputs.resize(params->flipFlopCount);
 
-      std::vector<unsigned> todo;
-      std::vector<unsigned> done;
+      const unsigned ff=params->flipFlopCount;
 
-      for(unsigned i=0; i<params->flipFlopCount; i++){
-	done.push_back(i);
+      // order[k] is the k-th gate to be wired, as a source index
+      std::mt19937_64 rnd(seed);
+      std::vector<unsigned> order(params->nandGateCount);
+      for(unsigned i=0; i<order.size(); i++){
+	order[i]=i+ff;
       }
-      for(unsigned i=0; i<params->nandGateCount; i++){
-	todo.push_back(i+params->flipFlopCount);
+      for(unsigned i=order.size(); i>1; i--){
+	std::swap(order[i-1], order[uniform(rnd(), i)]);
       }
 
-      while(todo.size()>0){
-	unsigned idx=rnd()%todo.size();
-	unsigned curr=todo[idx];
-	todo.erase(todo.begin()+idx);
-
-	unsigned currNand=curr - params->flipFlopCount;
-
-	unsigned src1=done[rnd()%done.size()];
-	unsigned src2=done[rnd()%done.size()];
-
-	params->nandGateInputs[currNand].first=src1;
-	params->nandGateInputs[currNand].second=src2;
-
-	done.push_back(curr);
+      // Anything wired before position k: flip-flops, then order[0..k)
+      auto done=[&](unsigned j) -> unsigned {
+	return j<ff ? j : order[j-ff];
+      };
+
+      auto wire=[&](unsigned begin, unsigned end){
+	for(unsigned k=begin; k<end; k++){
+	  uint64_t r=mix(seed, k);
+	  unsigned currNand=order[k] - ff;
+	  params->nandGateInputs[currNand].first=done(uniform(r, ff+k));
+	  params->nandGateInputs[currNand].second=done(uniform(r>>32 | r<<32, ff+k));
+	}
+      };
+
+      unsigned n=params->nandGateCount;
+      threads=std::max(1u, std::min(threads, n/65536+1));
+      log->LogVerbose("Wiring %u gates using %u threads", n, threads);
+      std::vector<std::thread> workers;
+      for(unsigned t=1; t<threads; t++){
+	workers.push_back(std::thread(wire, uint64_t(n)*t/threads, uint64_t(n)*(t+1)/threads));
+      }
+      wire(0, uint64_t(n)/threads);
+      for(auto &w : workers){
+	w.join();
       }
 
-      for(unsigned i=0; i<params->flipFlopCount; i++){
-	params->flipFlopInputs[i]=done[rnd()%done.size()];
+      for(unsigned i=0; i<ff; i++){
+	params->flipFlopInputs[i]=done(uniform(rnd(), ff+n));
       }
 
-      params->inputState.resize(params->flipFlopCount);
-      for(unsigned i=0; i<params->flipFlopCount; i++){
+      params->inputState.resize(ff);
+      for(unsigned i=0; i<ff; i++){
 	params->inputState[i] = 1 == (rnd()&1);
       }
 
@@ -1,6 +1,8 @@
 #ifndef puzzler_puzzles_life_hpp
 #define puzzler_puzzles_life_hpp
 
+#include <algorithm>
+#include <cstdlib>
 #include <random>
 #include <sstream>
 
@@ -72,10 +74,88 @@ namespace puzzler
   };
 
 
+  /*! How boards are drawn at Log_Debug, set by PUZZLER_LIFE_RENDER,
+    PUZZLER_LIFE_RENDER_INTERVAL and PUZZLER_LIFE_RENDER_WIDTH.
+
+    "full" draws every cell. "density" draws a map width characters
+    across and width/2 down (characters are about twice as tall as they
+    are wide), shading each block by how many of a fixed grid of sample
+    cells are alive, with a population estimated from the same samples
+    above it; its cost does not grow with n. "auto", the default, draws
+    boards that fit in the map in full.
+  */
+  struct LifeRenderOptions
+  {
+    std::string mode;
+    unsigned interval;
+    unsigned width;
+
+    LifeRenderOptions()
+      : mode("auto")
+      , interval(1)
+      , width(64)
+    {
+      if(getenv("PUZZLER_LIFE_RENDER"))
+        mode=getenv("PUZZLER_LIFE_RENDER");
+      if(getenv("PUZZLER_LIFE_RENDER_INTERVAL"))
+        interval=std::max(1, atoi(getenv("PUZZLER_LIFE_RENDER_INTERVAL")));
+      if(getenv("PUZZLER_LIFE_RENDER_WIDTH"))
+        width=std::max(2, atoi(getenv("PUZZLER_LIFE_RENDER_WIDTH")));
+    }
+
+    bool Due(unsigned generation) const
+    { return generation%interval==0; }
+
+    bool Full(unsigned n) const
+    { return mode=="full" || (mode!="density" && n<=width); }
+  };
+
   class LifePuzzle
     : public PuzzleBase<LifeInput,LifeOutput>
   {
   protected:
+    LifeRenderOptions m_render;
+
+    //! Draw a board, where get(x,y) says if a cell is alive
+    template<class TGet>
+    void render(std::ostream &dst, unsigned n, unsigned generation, TGet get) const
+    {
+      dst<<"\n";
+      if(m_render.Full(n)){
+        for(unsigned y=0; y<n; y++){
+          for(unsigned x=0; x<n; x++){
+            dst<<(get(x,y)?'x':' ');
+          }
+          dst<<"\n";
+        }
+        return;
+      }
+
+      const char shades[]=" .:-=+*#%@";
+      const unsigned Samples=4;  // per side of each block
+      unsigned w=std::min(m_render.width, n), h=std::min(m_render.width/2, n);
+      // Each sample stands for its share of the block it is in
+      std::string map;
+      double population=0;
+      for(unsigned j=0; j<h; j++){
+        uint64_t y0=uint64_t(j)*n/h, y1=uint64_t(j+1)*n/h;
+        for(unsigned i=0; i<w; i++){
+          uint64_t x0=uint64_t(i)*n/w, x1=uint64_t(i+1)*n/w;
+          unsigned alive=0;
+          for(unsigned sy=0; sy<Samples; sy++){
+            unsigned y=y0+(2*sy+1)*(y1-y0)/(2*Samples);
+            for(unsigned sx=0; sx<Samples; sx++){
+              alive+=get(unsigned(x0+(2*sx+1)*(x1-x0)/(2*Samples)), y);
+            }
+          }
+          population+=double(alive)*(x1-x0)*(y1-y0)/(Samples*Samples);
+          map+=shades[(alive*9+Samples*Samples/2)/(Samples*Samples)];
+        }
+        map+="\n";
+      }
+      dst<<"generation "<<generation<<", population ~"<<uint64_t(population+0.5)<<" (estimate), "<<n<<"x"<<n<<" as "<<w<<"x"<<h<<"\n";
+      dst<<map;
+    }
 
     bool update(int n, const std::vector<bool> &curr, int x, int y) const
     {
@@ -127,15 +207,18 @@ namespace puzzler
       unsigned n=pInput->n;
       std::vector<bool> state=pInput->state;
 
-      log->Log(Log_Debug, [&](std::ostream &dst){
-	  dst<<"\n";
-	  for(unsigned y=0; y<n; y++){
-	    for(unsigned x=0; x<n; x++){
-	      dst<<(state.at(y*n+x)?'x':' ');
-	    }
-	    dst<<"\n";
-	  }
-	});
+      auto draw=[&](unsigned generation){
+        if(!m_render.Due(generation))
+          return;
+        // The weird form of log is so that there is little overhead
+        // if logging is disabled
+        log->Log(Log_Debug, [&](std::ostream &dst){
+            render(dst, n, generation, [&](unsigned x, unsigned y){
+                return state[y*n+x];
+              });
+          });
+      };
+      draw(0);
 
       for(unsigned i=0; i<pInput->steps; i++){
         log->LogVerbose("Starting iteration %d of %d\n", i, pInput->steps);
@@ -150,17 +233,7 @@ namespace puzzler
 
         state=next;
 
-        // The weird form of log is so that there is little overhead
-        // if logging is disabled
-        log->Log(Log_Debug, [&](std::ostream &dst){
-	    dst<<"\n";
-	    for(unsigned y=0; y<n; y++){
-	      for(unsigned x=0; x<n; x++){
-		dst<<(state[y*n+x]?'x':' ');
-	      }
-	      dst<<"\n";
-	    }
-	  });
+        draw(i+1);
       }
 
       log->LogVerbose("Finished steps");
@@ -0,0 +1,120 @@
+#ifndef circuit_sim_batch_hpp
+#define circuit_sim_batch_hpp
+
+#include <cstdint>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "circuit_sim_compiled.hpp"
+
+/*! 256 circuits per word, one per bit lane.
+
+  Held as plain 64-bit words so that it is safe in a std::vector
+  without over-aligned allocation; the AVX2 path uses unaligned
+  loads and stores, which cost nothing extra on aligned data.
+*/
+struct CircuitSimWide
+{
+  uint64_t w[4];
+
+  friend CircuitSimWide operator&(const CircuitSimWide &a, const CircuitSimWide &b)
+  {
+    CircuitSimWide r;
+#ifdef __AVX2__
+    __m256i x=_mm256_loadu_si256((const __m256i*)a.w);
+    __m256i y=_mm256_loadu_si256((const __m256i*)b.w);
+    _mm256_storeu_si256((__m256i*)r.w, _mm256_and_si256(x,y));
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=a.w[i]&b.w[i];
+    }
+#endif
+    return r;
+  }
+
+  CircuitSimWide operator~() const
+  {
+    CircuitSimWide r;
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=~w[i];
+    }
+    return r;
+  }
+};
+
+//! Access to the individual circuits packed into a word
+template<class TWord>
+struct CircuitSimLanes;
+
+template<>
+struct CircuitSimLanes<uint64_t>
+{
+  enum{ Count=64 };
+
+  static void Set(uint64_t &x, unsigned lane, bool v)
+  { x |= uint64_t(v)<<lane; }
+
+  static bool Get(const uint64_t &x, unsigned lane)
+  { return (x>>lane)&1; }
+};
+
+template<>
+struct CircuitSimLanes<CircuitSimWide>
+{
+  enum{ Count=256 };
+
+  static void Set(CircuitSimWide &x, unsigned lane, bool v)
+  { x.w[lane/64] |= uint64_t(v)<<(lane%64); }
+
+  static bool Get(const CircuitSimWide &x, unsigned lane)
+  { return (x.w[lane/64]>>(lane%64))&1; }
+};
+
+/*! Simulate up to CircuitSimLanes<TWord>::Count circuits at once.
+
+  All instances share the netlist, so each NAND in the program is a
+  single bitwise operation covering every instance.
+*/
+template<class TWord>
+void CircuitSimRunBatch(
+                        const CircuitSimCompiled &netlist,
+                        unsigned clockCycles,
+                        const std::vector<bool> *const *inputStates,
+                        std::vector<bool> *const *outputStates,
+                        unsigned count
+                        )
+{
+  typedef CircuitSimLanes<TWord> lanes_t;
+  if(count>unsigned(lanes_t::Count))
+    throw std::runtime_error("CircuitSimRunBatch - too many instances for word type.");
+
+  unsigned flipFlopCount=netlist.flipFlopCount();
+
+  std::vector<TWord> values(netlist.slotCount(), TWord());
+  std::vector<TWord> scratch(flipFlopCount);
+  for(unsigned lane=0; lane<count; lane++){
+    const std::vector<bool> &state=*inputStates[lane];
+    if(state.size()!=flipFlopCount)
+      throw std::runtime_error("CircuitSimRunBatch - state size is inconsistent.");
+    for(unsigned i=0; i<flipFlopCount; i++){
+      lanes_t::Set(values[i], lane, state[i]);
+    }
+  }
+
+  for(unsigned c=0; c<clockCycles; c++){
+    netlist.Step(values.data(), scratch.data());
+  }
+
+  for(unsigned lane=0; lane<count; lane++){
+    std::vector<bool> &state=*outputStates[lane];
+    state.resize(flipFlopCount);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      state[i]=lanes_t::Get(values[i], lane);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef circuit_sim_codegen_hpp
+#define circuit_sim_codegen_hpp
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "circuit_sim_compiled.hpp"
+
+/*! Native code for one compiled netlist.
+
+  The gate program is written out as straight-line C++, so every source
+  index becomes an immediate offset, then built with the system compiler
+  into a shared object and loaded with dlopen. Values are 64-bit words
+  with one circuit per bit lane, the same convention as the interpreter.
+
+  Shared objects are cached by a hash of the netlist, so the compile
+  cost is only paid the first time a given netlist is seen. Whatever is
+  in the cache gets run in this process, so the cache directory and
+  the library must belong to this user and be writable by nobody else;
+  by default it is a private per-user directory (see DefaultCacheDir).
+  Sources are written to mkstemp names and the compiler is run without
+  a shell. If anything goes wrong (no compiler, an unsafe or unwritable
+  cache directory, dlopen fails) Available() is false and the caller
+  should fall back to the interpreter.
+*/
+class CircuitSimNative
+{
+private:
+  // No implementation for either
+  CircuitSimNative(const CircuitSimNative &); // = delete;
+  CircuitSimNative &operator=(const CircuitSimNative &); // = delete;
+
+  // Bump when the generated code changes, to invalidate old caches
+  static const unsigned Version=2;
+
+  // Statements per generated function, which keeps compile time sane
+  static const unsigned ChunkSize=4096;
+
+  typedef void (*eval_func_t)(uint64_t *values);
+  typedef void (*latch_func_t)(const uint64_t *values, uint64_t *next);
+
+  void *m_handle;
+  eval_func_t m_eval;
+  latch_func_t m_latch;
+  unsigned m_flipFlopCount;
+  std::string m_error;
+
+  static uint64_t hashNetlist(const CircuitSimCompiled &netlist, const std::string &compiler)
+  {
+    uint64_t h=14695981039346656037ull;
+    auto mix=[&](uint64_t x){
+      h=(h^x)*1099511628211ull;
+    };
+    mix(Version);
+    for(char c : compiler){
+      mix(uint8_t(c));
+    }
+    mix(netlist.flipFlopCount());
+    mix(netlist.gateCount());
+    for(unsigned i=0; i<netlist.gateCount(); i++){
+      mix((uint64_t(netlist.srcA()[i])<<32)|netlist.srcB()[i]);
+    }
+    for(uint32_t src : netlist.flipFlopSrcs()){
+      mix(src);
+    }
+    return h;
+  }
+
+  //! Owned by this user and not writable by anyone else
+  static bool isPrivate(const struct stat &info)
+  { return info.st_uid==getuid() && (info.st_mode & (S_IWGRP|S_IWOTH))==0; }
+
+  //! Write the source to an open descriptor, which is closed
+  static bool writeSource(const CircuitSimCompiled &netlist, int fd)
+  {
+    FILE *dst=fdopen(fd, "w");
+    if(!dst){
+      close(fd);
+      return false;
+    }
+    fprintf(dst, "#include <stdint.h>\n\n");
+
+    const std::vector<uint32_t> &srcA=netlist.srcA(), &srcB=netlist.srcB();
+    unsigned base=netlist.gateBase();
+    unsigned chunks=(srcA.size()+ChunkSize-1)/ChunkSize;
+    for(unsigned c=0; c<chunks; c++){
+      fprintf(dst, "static void eval%u(uint64_t *__restrict__ v)\n{\n", c);
+      unsigned end=std::min<unsigned>(srcA.size(), (c+1)*ChunkSize);
+      for(unsigned i=c*ChunkSize; i<end; i++){
+        fprintf(dst, "  v[%u]=~(v[%u]&v[%u]);\n", base+i, srcA[i], srcB[i]);
+      }
+      fprintf(dst, "}\n\n");
+    }
+
+    fprintf(dst, "extern \"C\" void circuit_sim_eval(uint64_t *v)\n{\n");
+    for(unsigned c=0; c<chunks; c++){
+      fprintf(dst, "  eval%u(v);\n", c);
+    }
+    fprintf(dst, "}\n\n");
+
+    fprintf(dst, "extern \"C\" void circuit_sim_latch(const uint64_t *__restrict__ v, uint64_t *__restrict__ next)\n{\n");
+    const std::vector<uint32_t> &srcs=netlist.flipFlopSrcs();
+    for(unsigned i=0; i<srcs.size(); i++){
+      fprintf(dst, "  next[%u]=v[%u];\n", i, srcs[i]);
+    }
+    fprintf(dst, "}\n");
+
+    return fclose(dst)==0;
+  }
+
+  /*! Run compiler (split on spaces, so it may carry flags) on source.
+
+    The source has no extension, so the language is given explicitly.
+  */
+  static bool compile(const std::string &compiler, const std::string &source, const std::string &output)
+  {
+    std::vector<std::string> args;
+    size_t pos=0;
+    while(pos<compiler.size()){
+      size_t end=compiler.find(' ', pos);
+      if(end==std::string::npos)
+        end=compiler.size();
+      if(end>pos)
+        args.push_back(compiler.substr(pos, end-pos));
+      pos=end+1;
+    }
+    if(args.empty())
+      return false;
+    for(const char *arg : {"-O1", "-shared", "-fPIC", "-o", output.c_str(), "-x", "c++", source.c_str()}){
+      args.push_back(arg);
+    }
+    std::vector<char*> argv;
+    for(std::string &arg : args){
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(0);
+
+    pid_t pid=fork();
+    if(pid<0)
+      return false;
+    if(pid==0){
+      execvp(argv[0], &argv[0]);
+      _exit(127);
+    }
+    int status=0;
+    while(waitpid(pid, &status, 0)<0){
+      if(errno!=EINTR)
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status)==0;
+  }
+
+public:
+  /*! $XDG_CACHE_HOME/puzzler, or ~/.cache/puzzler, created with mode 0700.
+
+    Returns an empty string if neither is usable, in which case there
+    is no cache and the backend is unavailable.
+  */
+  static std::string DefaultCacheDir()
+  {
+    std::string root;
+    if(getenv("XDG_CACHE_HOME") && getenv("XDG_CACHE_HOME")[0]){
+      root=getenv("XDG_CACHE_HOME");
+    }else if(getenv("HOME") && getenv("HOME")[0]){
+      root=std::string(getenv("HOME"))+"/.cache";
+    }else{
+      return std::string();
+    }
+    mkdir(root.c_str(), 0700);
+    std::string dir=root+"/puzzler";
+    mkdir(dir.c_str(), 0700);
+    return dir;
+  }
+
+  //! An empty cacheDir means DefaultCacheDir()
+  CircuitSimNative(
+                   const CircuitSimCompiled &netlist,
+                   const std::string &compiler,
+                   std::string cacheDir
+                   )
+    : m_handle(0)
+    , m_eval(0)
+    , m_latch(0)
+    , m_flipFlopCount(netlist.flipFlopCount())
+  {
+    if(cacheDir.empty()){
+      cacheDir=DefaultCacheDir();
+      if(cacheDir.empty()){
+        m_error="no cache directory (set HOME or XDG_CACHE_HOME)";
+        return;
+      }
+    }
+    struct stat info;
+    if(stat(cacheDir.c_str(), &info)!=0 || !S_ISDIR(info.st_mode) || !isPrivate(info)){
+      m_error="cache directory "+cacheDir+" is missing, or not private to this user";
+      return;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "circuit_sim_%016llx", (unsigned long long)hashNetlist(netlist, compiler));
+    std::string lib=cacheDir+"/"+name+".so";
+
+    if(lstat(lib.c_str(), &info)!=0){
+      // Build under private names then rename, so that concurrent
+      // processes never load a half-written library.
+      std::string source=cacheDir+"/"+name+".src.XXXXXX";
+      std::string output=cacheDir+"/"+name+".so.XXXXXX";
+      int sourceFd=mkstemp(&source[0]);
+      if(sourceFd<0){
+        m_error="couldn't create a source file in "+cacheDir;
+        return;
+      }
+      int outputFd=mkstemp(&output[0]);
+      if(outputFd<0){
+        close(sourceFd);
+        unlink(source.c_str());
+        m_error="couldn't create an output file in "+cacheDir;
+        return;
+      }
+      close(outputFd);
+      bool built=writeSource(netlist, sourceFd) && compile(compiler, source, output);
+      unlink(source.c_str());
+      // The linker may have replaced the file under the umask
+      if(!built || chmod(output.c_str(), 0700)!=0 || rename(output.c_str(), lib.c_str())!=0){
+        unlink(output.c_str());
+        m_error="couldn't build "+lib+" with '"+compiler+"'";
+        return;
+      }
+      if(lstat(lib.c_str(), &info)!=0){
+        m_error="couldn't find "+lib;
+        return;
+      }
+    }
+    if(!S_ISREG(info.st_mode) || !isPrivate(info)){
+      m_error=lib+" is not a regular file private to this user";
+      return;
+    }
+
+    m_handle=dlopen(lib.c_str(), RTLD_NOW|RTLD_LOCAL);
+    if(!m_handle){
+      m_error=dlerror();
+      return;
+    }
+    m_eval=(eval_func_t)dlsym(m_handle, "circuit_sim_eval");
+    m_latch=(latch_func_t)dlsym(m_handle, "circuit_sim_latch");
+    if(!m_eval || !m_latch){
+      m_error="missing symbols in "+lib;
+      m_eval=0;
+      m_latch=0;
+    }
+  }
+
+  ~CircuitSimNative()
+  {
+    if(m_handle){
+      dlclose(m_handle);
+    }
+  }
+
+  bool Available() const
+  { return m_eval!=0; }
+
+  //! Why the backend isn't available
+  const std::string &Error() const
+  { return m_error; }
+
+  //! Same contract as CircuitSimCompiled::Step
+  void Step(uint64_t *values, uint64_t *scratch) const
+  {
+    m_eval(values);
+    m_latch(values, scratch);
+    std::copy(scratch, scratch+m_flipFlopCount, values);
+  }
+};
+
+#endif
@@ -0,0 +1,423 @@
+#ifndef circuit_sim_compiled_hpp
+#define circuit_sim_compiled_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "puzzler/puzzles/circuit_sim.hpp"
+
+/*! A circuit netlist flattened into a levelised gate program.
+
+  The reference walks the NAND DAG recursively from every flip-flop
+  input on every cycle, so shared logic is recomputed once per path
+  through it. Here the DAG is sorted once per input, and each cycle
+  evaluates every gate exactly once into a dense array of values.
+
+  Values are indexed by slot:
+
+    [0, flipFlopCount)         current flip-flop state
+    [flipFlopCount, gateBase)  padding, always false
+    [gateBase, slotCount())    gate outputs, in program order
+
+  gateBase is a multiple of 64, so when values are bit-packed the state
+  occupies whole words of its own.
+
+  Gates are ordered by level (flip-flops are level 0, a gate is one
+  more than the deepest of its sources), so all gates within a level
+  are independent of each other. Within a level, gates are ordered by
+  their lowest source slot, so consecutive gates tend to read nearby
+  values. Sources are stored as separate arrays, which the evaluation
+  loops stream through.
+*/
+class CircuitSimCompiled
+{
+private:
+  unsigned m_flipFlopCount;
+  unsigned m_gateBase;
+
+  std::vector<uint32_t> m_srcA, m_srcB;  // Source slots, in evaluation order
+  std::vector<uint32_t> m_levelBegin;    // Program index where each level starts (plus end sentinel)
+  std::vector<uint32_t> m_flipFlopSrcs;  // Slot feeding each flip-flop
+  std::vector<uint32_t> m_originalGate;  // Netlist gate index of each program entry
+  std::vector<bool> m_readsOwnWord;      // Packed word has a gate reading another gate in the same word
+
+public:
+  //! src as an index, which must be below limit
+  static unsigned checkedSrc(int32_t src, unsigned limit)
+  {
+    if(src<0 || unsigned(src)>=limit)
+      throw std::runtime_error("CircuitSimCompiled - source index out of range.");
+    return unsigned(src);
+  }
+
+  //! Level of every gate, found with an explicit stack as the netlists
+  //! are far too deep for recursion.
+  static std::vector<uint32_t> CalcLevels(
+                                          unsigned flipFlopCount,
+                                          const std::vector<std::pair<int32_t,int32_t> > &nandGateInputs
+                                          )
+  {
+    unsigned limit=flipFlopCount+nandGateInputs.size();
+
+    enum{ Unvisited, Open, Done };
+    std::vector<uint8_t> state(nandGateInputs.size(), Unvisited);
+    std::vector<uint32_t> level(nandGateInputs.size(), 0);
+    std::vector<unsigned> stack;
+
+    auto levelOf=[&](unsigned src) -> uint32_t {
+      return src<flipFlopCount ? 0 : level[src-flipFlopCount];
+    };
+
+    for(unsigned root=0; root<nandGateInputs.size(); root++){
+      stack.push_back(root);
+      while(!stack.empty()){
+        unsigned g=stack.back();
+        unsigned a=checkedSrc(nandGateInputs[g].first, limit);
+        unsigned b=checkedSrc(nandGateInputs[g].second, limit);
+
+        if(state[g]==Done){
+          stack.pop_back();
+        }else if(state[g]==Open){
+          // Second visit, so both sources are finished
+          level[g]=1+std::max(levelOf(a), levelOf(b));
+          state[g]=Done;
+          stack.pop_back();
+        }else{
+          state[g]=Open;
+          for(unsigned src : {a, b}){
+            if(src<flipFlopCount)
+              continue;
+            // Open gates are exactly those on the current path
+            if(state[src-flipFlopCount]==Open)
+              throw std::runtime_error("CircuitSimCompiled - netlist contains a combinational loop.");
+            if(state[src-flipFlopCount]==Unvisited)
+              stack.push_back(src-flipFlopCount);
+          }
+        }
+      }
+    }
+    return level;
+  }
+
+  CircuitSimCompiled(
+                     unsigned flipFlopCount,
+                     const std::vector<std::pair<int32_t,int32_t> > &nandGateInputs,
+                     const std::vector<int32_t> &flipFlopInputs
+                     )
+    : m_flipFlopCount(flipFlopCount)
+    , m_gateBase((flipFlopCount+63)/64*64)
+  {
+    if(flipFlopInputs.size()!=flipFlopCount)
+      throw std::runtime_error("CircuitSimCompiled - flipFlopCount is inconsistent.");
+
+    unsigned gateCount=nandGateInputs.size();
+    std::vector<uint32_t> level=CalcLevels(flipFlopCount, nandGateInputs);
+
+    // Bucket the gates by level; level 0 is the flip-flops, which hold no gates
+    uint32_t maxLevel=0;
+    for(uint32_t l : level){
+      maxLevel=std::max(maxLevel, l);
+    }
+    std::vector<std::vector<uint32_t> > byLevel(maxLevel);
+    for(unsigned g=0; g<gateCount; g++){
+      byLevel[level[g]-1].push_back(g);
+    }
+
+    // Number level by level, so sources always have slots before their
+    // consumers are sorted.
+    std::vector<uint32_t> slot(flipFlopCount+gateCount);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      slot[i]=i;
+    }
+    auto slotOf=[&](int32_t src){ return slot[src]; };
+    std::vector<std::pair<uint32_t,uint32_t> > keyed;
+    for(const std::vector<uint32_t> &gates : byLevel){
+      m_levelBegin.push_back(m_originalGate.size());
+      keyed.clear();
+      for(uint32_t g : gates){
+        keyed.push_back(std::make_pair(std::min(slotOf(nandGateInputs[g].first), slotOf(nandGateInputs[g].second)), g));
+      }
+      std::sort(keyed.begin(), keyed.end());
+      for(const auto &k : keyed){
+        slot[flipFlopCount+k.second]=m_gateBase+m_originalGate.size();
+        m_originalGate.push_back(k.second);
+      }
+    }
+    m_levelBegin.push_back(gateCount);
+
+    m_srcA.resize(gateCount);
+    m_srcB.resize(gateCount);
+    for(unsigned i=0; i<gateCount; i++){
+      m_srcA[i]=slotOf(nandGateInputs[m_originalGate[i]].first);
+      m_srcB[i]=slotOf(nandGateInputs[m_originalGate[i]].second);
+    }
+
+    m_flipFlopSrcs.resize(flipFlopCount);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      m_flipFlopSrcs[i]=slot[checkedSrc(flipFlopInputs[i], flipFlopCount+gateCount)];
+    }
+
+    m_readsOwnWord.resize(packedWords());
+    for(unsigned i=0; i<gateCount; i++){
+      unsigned w=(m_gateBase+i)/64;
+      if(m_srcA[i]/64==w || m_srcB[i]/64==w)
+        m_readsOwnWord[w]=true;
+    }
+  }
+
+  CircuitSimCompiled(const puzzler::CircuitSimInput *input)
+    : CircuitSimCompiled(input->flipFlopCount, input->nandGateInputs, input->flipFlopInputs)
+  {}
+
+  unsigned flipFlopCount() const
+  { return m_flipFlopCount; }
+
+  //! Slot of the first gate; a multiple of 64
+  unsigned gateBase() const
+  { return m_gateBase; }
+
+  unsigned gateCount() const
+  { return m_srcA.size(); }
+
+  unsigned slotCount() const
+  { return m_gateBase+m_srcA.size(); }
+
+  //! 64-bit words needed to hold every slot bit-packed
+  unsigned packedWords() const
+  { return (slotCount()+63)/64; }
+
+  //! 64-bit words holding the bit-packed flip-flop state
+  unsigned packedStateWords() const
+  { return m_gateBase/64; }
+
+  unsigned levelCount() const
+  { return m_levelBegin.size()-1; }
+
+  const std::vector<uint32_t> &srcA() const
+  { return m_srcA; }
+
+  const std::vector<uint32_t> &srcB() const
+  { return m_srcB; }
+
+  const std::vector<uint32_t> &levelBegin() const
+  { return m_levelBegin; }
+
+  const std::vector<uint32_t> &flipFlopSrcs() const
+  { return m_flipFlopSrcs; }
+
+  //! Maps program index back to the gate index in the source netlist
+  const std::vector<uint32_t> &originalGate() const
+  { return m_originalGate; }
+
+  /*! Evaluate gates [begin,end) of the program in place.
+
+    T is any word type supporting & and ~, with true held as all ones,
+    so the same program drives a single circuit in a uint8_t or one
+    circuit per bit lane in wider words.
+  */
+  template<class T>
+  void EvaluateRange(T *values, unsigned begin, unsigned end) const
+  {
+    T *gates=values+m_gateBase;
+    const uint32_t *srcA=m_srcA.data(), *srcB=m_srcB.data();
+    for(unsigned i=begin; i<end; i++){
+      gates[i]=T(~(values[srcA[i]] & values[srcB[i]]));
+    }
+  }
+
+  template<class T>
+  void Evaluate(T *values) const
+  {
+    EvaluateRange(values, 0, gateCount());
+  }
+
+  //! Latch the flip-flop inputs; next must not alias values
+  template<class T>
+  void Latch(const T *values, T *next) const
+  {
+    for(unsigned i=0; i<m_flipFlopCount; i++){
+      next[i]=values[m_flipFlopSrcs[i]];
+    }
+  }
+
+  //! Advance one clock cycle, with the state held in values[0,flipFlopCount)
+  template<class T>
+  void Step(T *values, T *scratch) const
+  {
+    Evaluate(values);
+    Latch(values, scratch);
+    std::copy(scratch, scratch+m_flipFlopCount, values);
+  }
+
+  static bool GetBit(const uint64_t *bits, uint32_t slot)
+  { return (bits[slot/64]>>(slot%64))&1; }
+
+  /*! Evaluate gates [begin,end) with one bit per slot.
+
+    A million-gate netlist then needs 128KB of values rather than 1MB,
+    so the random source reads mostly hit in L2. Ranges starting on a
+    multiple of 64 can be run concurrently.
+  */
+  void EvaluatePackedRange(uint64_t *bits, unsigned begin, unsigned end) const
+  {
+    const uint32_t *srcA=m_srcA.data(), *srcB=m_srcB.data();
+    unsigned i=begin;
+    while(i<end){
+      unsigned s=m_gateBase+i;
+      unsigned wordEnd=std::min(end, i+64-s%64);
+      if(s%64==0 && wordEnd==i+64 && !m_readsOwnWord[s/64]){
+        // Whole word whose sources are all in earlier words, so it
+        // can be built in a register. ~(a&b) is applied once at the end.
+        uint64_t acc=0;
+        for(unsigned j=0; j<64; j++){
+          uint32_t a=srcA[i+j], b=srcB[i+j];
+          acc|=((bits[a/64]>>(a%64)) & (bits[b/64]>>(b%64)) & 1)<<j;
+        }
+        bits[s/64]=~acc;
+      }else{
+        // Partial word, or gates reading values from earlier in the same
+        // word, so write back after every gate.
+        uint64_t acc=bits[s/64] & ((uint64_t(1)<<(s%64))-1);
+        for(; i<wordEnd; i++, s++){
+          uint32_t a=srcA[i], b=srcB[i];
+          uint64_t v=~((bits[a/64]>>(a%64)) & (bits[b/64]>>(b%64))) & 1;
+          acc|=v<<(s%64);
+          bits[s/64]=acc;
+        }
+        continue;
+      }
+      i=wordEnd;
+    }
+  }
+
+  void EvaluatePacked(uint64_t *bits) const
+  {
+    EvaluatePackedRange(bits, 0, gateCount());
+  }
+
+  //! Latch into next, which holds packedStateWords() words
+  void LatchPacked(const uint64_t *bits, uint64_t *next) const
+  {
+    for(unsigned w=0; w<packedStateWords(); w++){
+      uint64_t acc=0;
+      unsigned end=std::min(m_flipFlopCount, 64*w+64);
+      for(unsigned i=64*w; i<end; i++){
+        acc|=uint64_t(GetBit(bits, m_flipFlopSrcs[i]))<<(i%64);
+      }
+      next[w]=acc;
+    }
+  }
+
+  void StepPacked(uint64_t *bits, uint64_t *scratch) const
+  {
+    EvaluatePacked(bits);
+    LatchPacked(bits, scratch);
+    std::copy(scratch, scratch+packedStateWords(), bits);
+  }
+};
+
+/*! Value layouts, so engines can be written once for both.
+
+  Each gives the size of the value and state arrays, single-slot
+  access, gate evaluation and latching, and a way of finding which
+  flip-flops differ between two states.
+*/
+
+//! One T per slot, with true as all ones
+template<class T>
+struct CircuitSimSlotLayout
+{
+  typedef T word_t;
+
+  static unsigned Words(const CircuitSimCompiled &netlist)
+  { return netlist.slotCount(); }
+
+  static unsigned StateWords(const CircuitSimCompiled &netlist)
+  { return netlist.flipFlopCount(); }
+
+  static bool Get(const T *values, unsigned slot)
+  { return values[slot]!=0; }
+
+  static void Set(T *values, unsigned slot, bool v)
+  { values[slot]=v ? T(~T(0)) : T(0); }
+
+  static void Flip(T *values, unsigned slot)
+  { values[slot]=T(~values[slot]); }
+
+  static void EvaluateRange(const CircuitSimCompiled &netlist, T *values, unsigned begin, unsigned end)
+  { netlist.EvaluateRange(values, begin, end); }
+
+  static void Latch(const CircuitSimCompiled &netlist, const T *values, T *next)
+  { netlist.Latch(values, next); }
+
+  static unsigned CountDiffs(const T *a, const T *b, unsigned words)
+  {
+    unsigned n=0;
+    for(unsigned i=0; i<words; i++){
+      n+=a[i]!=b[i];
+    }
+    return n;
+  }
+
+  template<class F>
+  static void ForEachDiff(const T *a, const T *b, unsigned words, F f)
+  {
+    for(unsigned i=0; i<words; i++){
+      if(a[i]!=b[i])
+        f(i);
+    }
+  }
+};
+
+//! One bit per slot
+struct CircuitSimPackedLayout
+{
+  typedef uint64_t word_t;
+
+  static unsigned Words(const CircuitSimCompiled &netlist)
+  { return netlist.packedWords(); }
+
+  static unsigned StateWords(const CircuitSimCompiled &netlist)
+  { return netlist.packedStateWords(); }
+
+  static bool Get(const uint64_t *bits, unsigned slot)
+  { return CircuitSimCompiled::GetBit(bits, slot); }
+
+  static void Set(uint64_t *bits, unsigned slot, bool v)
+  { bits[slot/64]=(bits[slot/64] & ~(uint64_t(1)<<(slot%64))) | (uint64_t(v)<<(slot%64)); }
+
+  static void Flip(uint64_t *bits, unsigned slot)
+  { bits[slot/64]^=uint64_t(1)<<(slot%64); }
+
+  static void EvaluateRange(const CircuitSimCompiled &netlist, uint64_t *bits, unsigned begin, unsigned end)
+  { netlist.EvaluatePackedRange(bits, begin, end); }
+
+  static void Latch(const CircuitSimCompiled &netlist, const uint64_t *bits, uint64_t *next)
+  { netlist.LatchPacked(bits, next); }
+
+  static unsigned CountDiffs(const uint64_t *a, const uint64_t *b, unsigned words)
+  {
+    unsigned n=0;
+    for(unsigned i=0; i<words; i++){
+      n+=__builtin_popcountll(a[i]^b[i]);
+    }
+    return n;
+  }
+
+  template<class F>
+  static void ForEachDiff(const uint64_t *a, const uint64_t *b, unsigned words, F f)
+  {
+    for(unsigned w=0; w<words; w++){
+      uint64_t diff=a[w]^b[w];
+      while(diff){
+        f(64*w+__builtin_ctzll(diff));
+        diff&=diff-1;
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef circuit_sim_cycles_hpp
+#define circuit_sim_cycles_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*! Spots the flip-flop state revisiting an earlier state.
+
+  The simulation is deterministic, so once a state repeats the circuit
+  is in a limit cycle and the final state can be found from the period.
+  Each state is reduced to a 64-bit fingerprint and kept in a fixed-size
+  open-addressed table, so memory is bounded however long the run. When
+  the table fills it is cleared and refilled from the current cycle,
+  which still catches any period shorter than the table.
+
+  A fingerprint match is only a candidate; callers must confirm it with
+  a full comparison before relying on it.
+*/
+class CircuitSimCycleDetector
+{
+private:
+  struct Entry
+  {
+    uint64_t fingerprint;
+    uint32_t cycle;
+  };
+
+  static const uint32_t Empty=0xFFFFFFFFu;
+
+  std::vector<Entry> m_table;
+  unsigned m_used;
+  unsigned m_maxUsed;
+
+public:
+  //! maxEntries==0 disables detection
+  CircuitSimCycleDetector(unsigned maxEntries)
+    : m_used(0)
+    , m_maxUsed(maxEntries)
+  {
+    unsigned size=1;
+    while(size < 2*maxEntries){
+      size*=2;
+    }
+    m_table.resize(maxEntries ? size : 0);
+    Clear();
+  }
+
+  bool Enabled() const
+  { return m_maxUsed>0; }
+
+  void Clear()
+  {
+    for(Entry &e : m_table){
+      e.cycle=Empty;
+    }
+    m_used=0;
+  }
+
+  static uint64_t Fingerprint(const void *state, size_t bytes)
+  {
+    const uint8_t *data=(const uint8_t*)state;
+    uint64_t h=0x9E3779B97F4A7C15ull ^ bytes;
+    size_t i=0;
+    for(; i+8<=bytes; i+=8){
+      uint64_t w;
+      memcpy(&w, data+i, 8);
+      h=(h^w)*0xFF51AFD7ED558CCDull;
+      h^=h>>32;
+    }
+    for(; i<bytes; i++){
+      h=(h^data[i])*0xC4CEB9FE1A85EC53ull;
+      h^=h>>29;
+    }
+    return h;
+  }
+
+  /*! Record the state seen at cycle.
+
+    Returns true, with previous set, if the fingerprint was already in
+    the table; otherwise the fingerprint is added and false is returned.
+  */
+  bool Observe(uint64_t fingerprint, uint32_t cycle, uint32_t &previous)
+  {
+    if(!Enabled())
+      return false;
+
+    if(m_used>=m_maxUsed)
+      Clear();
+
+    uint64_t mask=m_table.size()-1;
+    uint64_t i=(fingerprint ^ (fingerprint>>31)) & mask;
+    while(m_table[i].cycle!=Empty){
+      if(m_table[i].fingerprint==fingerprint){
+        previous=m_table[i].cycle;
+        return true;
+      }
+      i=(i+1)&mask;
+    }
+    m_table[i].fingerprint=fingerprint;
+    m_table[i].cycle=cycle;
+    m_used++;
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef circuit_sim_events_hpp
+#define circuit_sim_events_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "circuit_sim_compiled.hpp"
+
+/*! Event-driven evaluation of a compiled netlist.
+
+  Gate values are kept from one cycle to the next, and only gates
+  downstream of flip-flops that toggled are re-evaluated; propagation
+  stops at any gate whose output doesn't change. Work is bucketed by
+  level so every gate is evaluated at most once per cycle, after all
+  of its sources have settled.
+
+  When many flip-flops toggle, chasing fan-out costs more than just
+  evaluating everything, so cycles where the toggled fraction exceeds
+  maxToggleFraction use the supplied full evaluation instead.
+
+  TLayout is one of the value layouts from circuit_sim_compiled.hpp.
+*/
+template<class TLayout>
+class CircuitSimEventDriven
+{
+private:
+  const CircuitSimCompiled &m_netlist;
+  double m_maxToggleFraction;
+
+  // Fan-out of every slot, as program indices, in CSR form
+  std::vector<uint32_t> m_fanoutBegin;
+  std::vector<uint32_t> m_fanout;
+  std::vector<uint32_t> m_levelOf;
+
+  std::vector<std::vector<uint32_t> > m_buckets;
+  std::vector<uint8_t> m_queued;
+  std::vector<uint32_t> m_toggled;
+  bool m_valid;
+
+  uint64_t m_cycles;
+  uint64_t m_fullCycles;
+  uint64_t m_evaluated;
+
+  void enqueueFanout(uint32_t slot)
+  {
+    for(uint32_t j=m_fanoutBegin[slot]; j<m_fanoutBegin[slot+1]; j++){
+      uint32_t g=m_fanout[j];
+      if(!m_queued[g]){
+        m_queued[g]=1;
+        m_buckets[m_levelOf[g]].push_back(g);
+      }
+    }
+  }
+
+public:
+  CircuitSimEventDriven(const CircuitSimCompiled &netlist, double maxToggleFraction)
+    : m_netlist(netlist)
+    , m_maxToggleFraction(maxToggleFraction)
+    , m_buckets(netlist.levelCount())
+    , m_queued(netlist.gateCount(), 0)
+    , m_valid(false)
+    , m_cycles(0)
+    , m_fullCycles(0)
+    , m_evaluated(0)
+  {
+    const std::vector<uint32_t> &srcA=netlist.srcA(), &srcB=netlist.srcB();
+
+    m_fanoutBegin.assign(netlist.slotCount()+1, 0);
+    for(unsigned i=0; i<srcA.size(); i++){
+      m_fanoutBegin[srcA[i]+1]++;
+      if(srcB[i]!=srcA[i])
+        m_fanoutBegin[srcB[i]+1]++;
+    }
+    for(unsigned i=1; i<m_fanoutBegin.size(); i++){
+      m_fanoutBegin[i]+=m_fanoutBegin[i-1];
+    }
+    m_fanout.resize(m_fanoutBegin.back());
+    std::vector<uint32_t> cursor(m_fanoutBegin.begin(), m_fanoutBegin.end()-1);
+    for(unsigned i=0; i<srcA.size(); i++){
+      m_fanout[cursor[srcA[i]]++]=i;
+      if(srcB[i]!=srcA[i])
+        m_fanout[cursor[srcB[i]]++]=i;
+    }
+
+    m_levelOf.resize(srcA.size());
+    for(unsigned l=0; l<netlist.levelCount(); l++){
+      for(unsigned i=netlist.levelBegin()[l]; i<netlist.levelBegin()[l+1]; i++){
+        m_levelOf[i]=l;
+      }
+    }
+  }
+
+  typedef typename TLayout::word_t word_t;
+
+  /*! Advance one clock cycle; same contract as CircuitSimCompiled::Step.
+
+    values must only be changed through this object between calls, as
+    the gate values from the previous cycle are reused.
+  */
+  template<class TEvaluateAll>
+  void Step(word_t *values, word_t *scratch, TEvaluateAll evaluateAll)
+  {
+    unsigned gateBase=m_netlist.gateBase();
+    const uint32_t *srcA=m_netlist.srcA().data(), *srcB=m_netlist.srcB().data();
+
+    m_cycles++;
+    if(!m_valid){
+      evaluateAll(values);
+      m_valid=true;
+      m_fullCycles++;
+      m_evaluated+=m_netlist.gateCount();
+    }else{
+      for(uint32_t f : m_toggled){
+        enqueueFanout(f);
+      }
+      for(std::vector<uint32_t> &bucket : m_buckets){
+        for(uint32_t g : bucket){
+          m_queued[g]=0;
+          uint32_t s=gateBase+g;
+          bool v=!(TLayout::Get(values, srcA[g]) && TLayout::Get(values, srcB[g]));
+          if(v!=TLayout::Get(values, s)){
+            TLayout::Flip(values, s);
+            enqueueFanout(s);
+          }
+        }
+        m_evaluated+=bucket.size();
+        bucket.clear();
+      }
+    }
+
+    // Toggles are counted first, as in busy cycles the list isn't needed
+    unsigned words=TLayout::StateWords(m_netlist);
+    TLayout::Latch(m_netlist, values, scratch);
+    unsigned toggles=TLayout::CountDiffs(scratch, values, words);
+    m_toggled.clear();
+    if(toggles <= m_maxToggleFraction*m_netlist.flipFlopCount()){
+      TLayout::ForEachDiff(scratch, values, words, [&](unsigned i){
+          m_toggled.push_back(i);
+        });
+    }else{
+      m_valid=false;
+    }
+    std::copy(scratch, scratch+words, values);
+  }
+
+  //! Average fraction of gates evaluated per cycle
+  double ActivityFactor() const
+  { return m_cycles && m_netlist.gateCount() ? double(m_evaluated)/(double(m_cycles)*m_netlist.gateCount()) : 0.0; }
+
+  uint64_t Cycles() const
+  { return m_cycles; }
+
+  //! Cycles that fell back to evaluating every gate
+  uint64_t FullCycles() const
+  { return m_fullCycles; }
+};
+
+#endif
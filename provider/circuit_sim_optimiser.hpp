@@ -0,0 +1,190 @@
+#ifndef circuit_sim_optimiser_hpp
+#define circuit_sim_optimiser_hpp
+
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "circuit_sim_compiled.hpp"
+
+/*! Netlist clean-up run before compilation.
+
+  The random netlists from CircuitSimPuzzle::CreateInput contain a lot
+  of redundant logic. This pass, in topological order:
+
+  - folds double inversions, NAND(NAND(x,x),NAND(x,x)) -> x;
+  - merges structurally identical gates (same pair of sources, in
+    either order) into one;
+  - drops every gate that does not reach a flip-flop input.
+
+  The result uses the same source encoding as CircuitSimInput (sources
+  below flipFlopCount are flip-flops), with gates renumbered so that
+  each gate only refers to earlier ones. Flip-flop numbering, and so the
+  meaning of the state vector, is unchanged.
+*/
+class CircuitSimOptimised
+{
+private:
+  unsigned m_flipFlopCount;
+  std::vector<std::pair<int32_t,int32_t> > m_nandGateInputs;
+  std::vector<int32_t> m_flipFlopInputs;
+
+  unsigned m_folded;
+  unsigned m_merged;
+  unsigned m_dead;
+
+public:
+  CircuitSimOptimised(
+                      unsigned flipFlopCount,
+                      const std::vector<std::pair<int32_t,int32_t> > &nandGateInputs,
+                      const std::vector<int32_t> &flipFlopInputs
+                      )
+    : m_flipFlopCount(flipFlopCount)
+    , m_folded(0)
+    , m_merged(0)
+    , m_dead(0)
+  {
+    // Checked as in CircuitSimCompiled, as the netlist is read here first
+    if(flipFlopInputs.size()!=flipFlopCount)
+      throw std::runtime_error("CircuitSimOptimised - flipFlopCount is inconsistent.");
+
+    unsigned gateCount=nandGateInputs.size();
+    unsigned nodeCount=flipFlopCount+gateCount;
+    for(unsigned i=0; i<flipFlopCount; i++){
+      CircuitSimCompiled::checkedSrc(flipFlopInputs[i], nodeCount);
+    }
+
+    // Also validates the gate sources and rejects loops
+    std::vector<uint32_t> level=CircuitSimCompiled::CalcLevels(flipFlopCount, nandGateInputs);
+
+    std::vector<uint32_t> order(gateCount);
+    {
+      uint32_t maxLevel=0;
+      for(uint32_t l : level){
+        maxLevel=std::max(maxLevel, l);
+      }
+      std::vector<uint32_t> begin(maxLevel+2, 0);
+      for(uint32_t l : level){
+        begin[l+1]++;
+      }
+      for(unsigned l=1; l<begin.size(); l++){
+        begin[l]+=begin[l-1];
+      }
+      for(unsigned g=0; g<gateCount; g++){
+        order[begin[level[g]]++]=g;
+      }
+    }
+
+    // Every node is replaced by a canonical node computing the same value
+    const uint32_t NotInverter=0xFFFFFFFFu;
+    std::vector<uint32_t> rep(nodeCount);
+    std::vector<uint32_t> inverterOf(nodeCount, NotInverter);
+    std::vector<std::pair<uint32_t,uint32_t> > srcs(gateCount);
+    std::vector<bool> kept(gateCount, false);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      rep[i]=i;
+    }
+
+    std::unordered_map<uint64_t,uint32_t> structure;
+    structure.reserve(gateCount);
+
+    for(uint32_t g : order){
+      uint32_t a=rep[nandGateInputs[g].first];
+      uint32_t b=rep[nandGateInputs[g].second];
+      if(a>b)
+        std::swap(a,b);
+
+      uint32_t node=flipFlopCount+g;
+      if(a==b && inverterOf[a]!=NotInverter){
+        rep[node]=inverterOf[a];
+        m_folded++;
+        continue;
+      }
+
+      uint64_t key=(uint64_t(a)<<32)|b;
+      auto it=structure.find(key);
+      if(it!=structure.end()){
+        rep[node]=it->second;
+        m_merged++;
+        continue;
+      }
+
+      structure[key]=node;
+      rep[node]=node;
+      srcs[g]=std::make_pair(a,b);
+      kept[g]=true;
+      if(a==b)
+        inverterOf[node]=a;
+    }
+
+    // Cone of influence, walking back from the flip-flop inputs
+    std::vector<bool> live(gateCount, false);
+    m_flipFlopInputs.resize(flipFlopCount);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      uint32_t src=rep[flipFlopInputs[i]];
+      m_flipFlopInputs[i]=src;
+      if(src>=flipFlopCount)
+        live[src-flipFlopCount]=true;
+    }
+    for(unsigned i=gateCount; i>0; i--){
+      uint32_t g=order[i-1];
+      if(!live[g])
+        continue;
+      for(uint32_t src : {srcs[g].first, srcs[g].second}){
+        if(src>=flipFlopCount)
+          live[src-flipFlopCount]=true;
+      }
+    }
+
+    // Renumber the survivors in topological order
+    std::vector<uint32_t> renum(nodeCount);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      renum[i]=i;
+    }
+    for(uint32_t g : order){
+      if(!kept[g])
+        continue;
+      if(!live[g]){
+        m_dead++;
+        continue;
+      }
+      renum[flipFlopCount+g]=flipFlopCount+m_nandGateInputs.size();
+      m_nandGateInputs.push_back(std::make_pair(int32_t(renum[srcs[g].first]), int32_t(renum[srcs[g].second])));
+    }
+    for(unsigned i=0; i<flipFlopCount; i++){
+      m_flipFlopInputs[i]=renum[m_flipFlopInputs[i]];
+    }
+  }
+
+  CircuitSimOptimised(const puzzler::CircuitSimInput *input)
+    : CircuitSimOptimised(input->flipFlopCount, input->nandGateInputs, input->flipFlopInputs)
+  {}
+
+  unsigned flipFlopCount() const
+  { return m_flipFlopCount; }
+
+  const std::vector<std::pair<int32_t,int32_t> > &nandGateInputs() const
+  { return m_nandGateInputs; }
+
+  const std::vector<int32_t> &flipFlopInputs() const
+  { return m_flipFlopInputs; }
+
+  //! Gates removed as double inversions
+  unsigned foldedCount() const
+  { return m_folded; }
+
+  //! Gates removed as duplicates of an existing gate
+  unsigned mergedCount() const
+  { return m_merged; }
+
+  //! Gates removed as not reaching any flip-flop
+  unsigned deadCount() const
+  { return m_dead; }
+
+  unsigned removedCount() const
+  { return m_folded+m_merged+m_dead; }
+};
+
+#endif
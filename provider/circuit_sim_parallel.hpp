@@ -0,0 +1,39 @@
+#ifndef circuit_sim_parallel_hpp
+#define circuit_sim_parallel_hpp
+
+#include "circuit_sim_compiled.hpp"
+#include "thread_pool.hpp"
+
+/*! Evaluate every gate, splitting each level across a pool.
+
+  Gates within a level only read earlier levels, so a level can be
+  shared out freely, and ThreadPool::Run acts as the barrier before the
+  next one. Levels narrower than minWidth are not worth the hand-off
+  and run on the calling thread. Chunks are split on 64-gate boundaries,
+  which keeps threads out of each other's words when values are
+  bit-packed, and out of each other's cache lines when they are bytes.
+*/
+template<class TLayout>
+void CircuitSimParallelEvaluate(
+                                const CircuitSimCompiled &netlist,
+                                ThreadPool &pool,
+                                unsigned minWidth,
+                                typename TLayout::word_t *values
+                                )
+{
+  const std::vector<uint32_t> &levelBegin=netlist.levelBegin();
+  for(unsigned l=0; l<netlist.levelCount(); l++){
+    unsigned begin=levelBegin[l], end=levelBegin[l+1];
+    if(end-begin < minWidth){
+      TLayout::EvaluateRange(netlist, values, begin, end);
+    }else{
+      // Work in blocks of 64 gates, clipped back to the level
+      unsigned blockBegin=begin/64, blockEnd=(end+63)/64;
+      pool.ParallelFor(blockEnd-blockBegin, std::max(1u, minWidth/128), [&](unsigned b, unsigned e){
+          TLayout::EvaluateRange(netlist, values, std::max(begin, 64*(blockBegin+b)), std::min(end, 64*(blockBegin+e)));
+        });
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef circuit_sim_trace_hpp
+#define circuit_sim_trace_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*! Compact binary record of flip-flop activity.
+
+  Format (all integers little-endian or LEB128 varints):
+
+    "CSTRACE1"
+    uint32 flipFlopCount
+    initial state, bit-packed LSB first, (flipFlopCount+7)/8 bytes
+    per cycle with at least one toggle:
+      varint  cycles since the previous record (first is from 0)
+      varint  1+gap to each toggled flip-flop, in increasing order
+      varint  0
+
+  Only toggles are stored, so quiet cycles cost nothing and busy ones a
+  byte or so per change. Records go into a preallocated buffer which is
+  written out when full, so tracing adds no allocation or formatting to
+  the cycle loop. CircuitSimTraceToVcd converts a trace for waveform
+  viewers.
+*/
+class CircuitSimTraceWriter
+{
+private:
+  // No implementation for either
+  CircuitSimTraceWriter(const CircuitSimTraceWriter &); // = delete;
+  CircuitSimTraceWriter &operator=(const CircuitSimTraceWriter &); // = delete;
+
+  FILE *m_dst;
+  std::vector<uint8_t> m_buffer;
+  size_t m_used;
+
+  uint64_t m_lastCycle;
+  uint64_t m_cycle;
+  int64_t m_lastIndex;  // -1 while no toggle has been recorded for this cycle
+
+  void flush()
+  {
+    if(m_used && fwrite(m_buffer.data(), 1, m_used, m_dst)!=m_used)
+      throw std::runtime_error("CircuitSimTraceWriter - Couldn't write trace.");
+    m_used=0;
+  }
+
+  void put(uint64_t x)
+  {
+    if(m_used+10 > m_buffer.size())
+      flush();
+    do{
+      uint8_t b=x&0x7F;
+      x>>=7;
+      m_buffer[m_used++]=b | (x ? 0x80 : 0);
+    }while(x);
+  }
+
+public:
+  CircuitSimTraceWriter(const std::string &path, const std::vector<bool> &initialState, size_t bufferBytes=1<<20)
+    : m_dst(fopen(path.c_str(), "wb"))
+    , m_buffer(std::max<size_t>(bufferBytes, 64))
+    , m_used(0)
+    , m_lastCycle(0)
+    , m_cycle(0)
+    , m_lastIndex(-1)
+  {
+    if(!m_dst)
+      throw std::runtime_error("CircuitSimTraceWriter - Couldn't open '"+path+"'");
+
+    std::vector<uint8_t> header(12+(initialState.size()+7)/8, 0);
+    memcpy(&header[0], "CSTRACE1", 8);
+    uint32_t n=initialState.size();
+    for(unsigned i=0; i<4; i++){
+      header[8+i]=uint8_t(n>>(8*i));
+    }
+    for(unsigned i=0; i<n; i++){
+      header[12+i/8] |= uint8_t(initialState[i])<<(i%8);
+    }
+    if(fwrite(header.data(), 1, header.size(), m_dst)!=header.size())
+      throw std::runtime_error("CircuitSimTraceWriter - Couldn't write trace header.");
+  }
+
+  ~CircuitSimTraceWriter()
+  {
+    try{
+      flush();
+    }catch(...){
+      // Nothing sensible to do in a destructor
+    }
+    fclose(m_dst);
+  }
+
+  //! Start recording the changes that produced the state after cycle
+  void BeginCycle(uint64_t cycle)
+  {
+    m_cycle=cycle;
+    m_lastIndex=-1;
+  }
+
+  //! Toggles must be reported in increasing order within a cycle
+  void Toggle(uint32_t index)
+  {
+    if(m_lastIndex<0){
+      put(m_cycle-m_lastCycle);
+      m_lastCycle=m_cycle;
+    }
+    put(uint64_t(int64_t(index)-m_lastIndex));
+    m_lastIndex=index;
+  }
+
+  void EndCycle()
+  {
+    if(m_lastIndex>=0)
+      put(0);
+  }
+};
+
+//! Convert a binary trace into a Value Change Dump, one wire per flip-flop
+inline void CircuitSimTraceToVcd(const std::string &tracePath, const std::string &vcdPath)
+{
+  FILE *src=fopen(tracePath.c_str(), "rb");
+  if(!src)
+    throw std::runtime_error("CircuitSimTraceToVcd - Couldn't open '"+tracePath+"'");
+  std::vector<uint8_t> data;
+  uint8_t chunk[1<<16];
+  size_t got;
+  while((got=fread(chunk, 1, sizeof(chunk), src))>0){
+    data.insert(data.end(), chunk, chunk+got);
+  }
+  fclose(src);
+
+  if(data.size()<12 || memcmp(&data[0], "CSTRACE1", 8))
+    throw std::runtime_error("CircuitSimTraceToVcd - Not a circuit_sim trace.");
+  uint32_t n=0;
+  for(unsigned i=0; i<4; i++){
+    n|=uint32_t(data[8+i])<<(8*i);
+  }
+  size_t pos=12+(n+7)/8;
+  if(data.size()<pos)
+    throw std::runtime_error("CircuitSimTraceToVcd - Truncated header.");
+  std::vector<bool> state(n);
+  for(unsigned i=0; i<n; i++){
+    state[i]=(data[12+i/8]>>(i%8))&1;
+  }
+
+  auto get=[&]() -> uint64_t {
+    uint64_t x=0;
+    unsigned shift=0;
+    while(true){
+      if(pos>=data.size())
+        throw std::runtime_error("CircuitSimTraceToVcd - Truncated record.");
+      uint8_t b=data[pos++];
+      x|=uint64_t(b&0x7F)<<shift;
+      if(!(b&0x80))
+        return x;
+      shift+=7;
+    }
+  };
+
+  // VCD identifiers are strings of printable characters '!'..'~'
+  auto id=[](uint32_t i){
+    std::string res;
+    do{
+      res+=char(33+i%94);
+      i/=94;
+    }while(i);
+    return res;
+  };
+
+  FILE *dst=fopen(vcdPath.c_str(), "w");
+  if(!dst)
+    throw std::runtime_error("CircuitSimTraceToVcd - Couldn't open '"+vcdPath+"'");
+  fprintf(dst, "$timescale 1ns $end\n$scope module circuit_sim $end\n");
+  for(uint32_t i=0; i<n; i++){
+    fprintf(dst, "$var wire 1 %s ff%u $end\n", id(i).c_str(), i);
+  }
+  fprintf(dst, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+  for(uint32_t i=0; i<n; i++){
+    fprintf(dst, "%d%s\n", state[i]?1:0, id(i).c_str());
+  }
+  fprintf(dst, "$end\n");
+
+  uint64_t cycle=0;
+  while(pos<data.size()){
+    cycle+=get();
+    fprintf(dst, "#%llu\n", (unsigned long long)cycle);
+    int64_t index=-1;
+    uint64_t gap;
+    while((gap=get())!=0){
+      index+=gap;
+      if(index>=int64_t(n))
+        throw std::runtime_error("CircuitSimTraceToVcd - Flip-flop index out of range.");
+      state[index]=!state[index];
+      fprintf(dst, "%d%s\n", state[index]?1:0, id(index).c_str());
+    }
+  }
+  fclose(dst);
+}
+
+#endif
@@ -0,0 +1,491 @@
+#ifndef circuit_sim_whatif_hpp
+#define circuit_sim_whatif_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "circuit_sim_compiled.hpp"
+
+/*! Re-simulation of a recorded run with a few initial bits flipped.
+
+  The baseline trajectory is recorded once, one bit per flip-flop per
+  cycle. If the whole trajectory is larger than maxBaselineBytes, only
+  every interval-th state is kept, and the states of one segment of
+  interval cycles at a time are re-simulated from there as runs reach
+  it. A perturbed run then only tracks which flip-flops differ from
+  the baseline: each cycle it evaluates the gates that feed flip-flops
+  reachable from the differing ones (the fan-in of their fan-out cone),
+  and every other flip-flop just takes its next baseline value.
+
+  Up to 64 perturbations share each pass, one per bit lane. A lane whose
+  difference dies out has converged and matches the baseline from then
+  on, so passes run over windows of doubling length and the surviving
+  lanes are repacked between windows, which never cross the end of a
+  segment. When the region to evaluate exceeds maxConeFraction of the netlist, the cycle
+  falls back to evaluating every gate, which is what a lane that has
+  diverged completely would need anyway.
+*/
+class CircuitSimWhatIf
+{
+private:
+  CircuitSimCompiled m_netlist;
+  unsigned m_clockCycles;
+  double m_maxConeFraction;
+
+  // Baseline states, m_stateWords each: every m_interval-th one, the
+  // final one, and those of the segment [m_segment*m_interval, (m_segment+1)*m_interval]
+  unsigned m_stateWords;
+  unsigned m_interval;
+  std::vector<uint64_t> m_checkpoints;
+  std::vector<uint64_t> m_final;
+  std::vector<uint64_t> m_states;
+  unsigned m_segment;
+
+  // Per-slot values for re-simulating the baseline
+  std::vector<uint8_t> m_simValues, m_simScratch;
+
+  // Gates reading each slot, and flip-flops latching each slot (CSR)
+  std::vector<uint32_t> m_fanoutBegin, m_fanout;
+  std::vector<uint32_t> m_latchBegin, m_latch;
+
+  // Per-pass scratch, with marks compared against m_epoch
+  std::vector<uint64_t> m_values;
+  std::vector<uint64_t> m_diff;
+  std::vector<uint32_t> m_mark;
+  uint32_t m_epoch;
+
+  // Per-cycle scratch for step
+  std::vector<uint32_t> m_stack, m_affected, m_gates;
+  std::vector<uint64_t> m_next;
+
+  uint64_t m_incrementalCycles;
+  uint64_t m_fullCycles;
+  uint64_t m_evaluated;
+
+  //! All ones or all zeros; cycle must be in the loaded segment
+  uint64_t baseline(unsigned cycle, unsigned ff) const
+  {
+    uint64_t index=uint64_t(cycle-m_segment*m_interval)*m_stateWords+ff/64;
+    return 0-((m_states[index]>>(ff%64))&1);
+  }
+
+  static uint64_t finalBit(const std::vector<uint64_t> &state, unsigned ff)
+  { return (state[ff/64]>>(ff%64))&1; }
+
+  void storeState(uint64_t *dst) const
+  {
+    std::fill(dst, dst+m_stateWords, 0);
+    for(unsigned i=0; i<m_netlist.flipFlopCount(); i++){
+      dst[i/64] |= uint64_t(m_simValues[i]&1)<<(i%64);
+    }
+  }
+
+  //! Re-simulate the states of segment s from its checkpoint, if not already there
+  void loadSegment(unsigned s)
+  {
+    if(s==m_segment)
+      return;
+    unsigned ff=m_netlist.flipFlopCount();
+    const uint64_t *src=&m_checkpoints[uint64_t(s)*m_stateWords];
+    for(unsigned i=0; i<ff; i++){
+      m_simValues[i]=(src[i/64]>>(i%64))&1 ? 0xFF : 0;
+    }
+    unsigned begin=s*m_interval, end=unsigned(std::min<uint64_t>(m_clockCycles, uint64_t(begin)+m_interval));
+    for(unsigned t=begin; t<=end; t++){
+      storeState(&m_states[uint64_t(t-begin)*m_stateWords]);
+      if(t<end){
+        m_netlist.Step(m_simValues.data(), m_simScratch.data());
+      }
+    }
+    m_segment=s;
+  }
+
+  //! Group items by key: items of key k end up in [begin[k],begin[k+1])
+  static void buildCsr(unsigned keyCount, const std::vector<uint32_t> &keys, const std::vector<uint32_t> &values,
+                       std::vector<uint32_t> &begin, std::vector<uint32_t> &items)
+  {
+    begin.assign(keyCount+1, 0);
+    for(uint32_t k : keys){
+      begin[k+1]++;
+    }
+    for(unsigned i=1; i<begin.size(); i++){
+      begin[i]+=begin[i-1];
+    }
+    items.resize(keys.size());
+    std::vector<uint32_t> cursor(begin.begin(), begin.end()-1);
+    for(unsigned i=0; i<keys.size(); i++){
+      items[cursor[keys[i]]++]=values[i];
+    }
+  }
+
+  uint32_t nextEpoch()
+  {
+    if(++m_epoch==0){
+      std::fill(m_mark.begin(), m_mark.end(), 0);
+      m_epoch=1;
+    }
+    return m_epoch;
+  }
+
+  /*! Advance the differing set one cycle from cycle t.
+
+    diffs lists the flip-flops with a non-zero m_diff; on return it holds
+    the ones that differ at t+1.
+  */
+  void step(unsigned t, std::vector<uint32_t> &diffs)
+  {
+    const uint32_t *srcA=m_netlist.srcA().data(), *srcB=m_netlist.srcB().data();
+    const uint32_t *ffSrcs=m_netlist.flipFlopSrcs().data();
+    unsigned ff=m_netlist.flipFlopCount(), gateBase=m_netlist.gateBase();
+    unsigned limit=unsigned(m_maxConeFraction*m_netlist.gateCount());
+
+    // Fan-out cone of the differing flip-flops, and the flip-flops it reaches
+    uint32_t coneEpoch=nextEpoch();
+    std::vector<uint32_t> &stack=m_stack, &affected=m_affected, &gates=m_gates;
+    stack.assign(diffs.begin(), diffs.end());
+    affected.clear();
+    for(uint32_t f : diffs){
+      m_mark[f]=coneEpoch;
+    }
+    bool full=false;
+    unsigned coneSize=0;
+    while(!stack.empty() && !full){
+      uint32_t s=stack.back();
+      stack.pop_back();
+      for(uint32_t j=m_latchBegin[s]; j<m_latchBegin[s+1]; j++){
+        affected.push_back(m_latch[j]);
+      }
+      for(uint32_t j=m_fanoutBegin[s]; j<m_fanoutBegin[s+1]; j++){
+        uint32_t g=gateBase+m_fanout[j];
+        if(m_mark[g]!=coneEpoch){
+          m_mark[g]=coneEpoch;
+          stack.push_back(g);
+          full = ++coneSize > limit;
+        }
+      }
+    }
+
+    // Fan-in of the affected flip-flops, which must all be evaluated
+    gates.clear();
+    if(!full){
+      uint32_t needEpoch=nextEpoch();
+      stack.clear();
+      for(uint32_t f : affected){
+        stack.push_back(ffSrcs[f]);
+      }
+      while(!stack.empty() && !full){
+        uint32_t s=stack.back();
+        stack.pop_back();
+        if(m_mark[s]==needEpoch)
+          continue;
+        m_mark[s]=needEpoch;
+        if(s<ff){
+          m_values[s]=baseline(t, s)^m_diff[s];
+        }else{
+          gates.push_back(s-gateBase);
+          stack.push_back(srcA[s-gateBase]);
+          stack.push_back(srcB[s-gateBase]);
+          full = gates.size() > limit;
+        }
+      }
+    }
+
+    if(full){
+      for(unsigned i=0; i<ff; i++){
+        m_values[i]=baseline(t, i)^m_diff[i];
+      }
+      m_netlist.Evaluate(m_values.data());
+      m_evaluated+=m_netlist.gateCount();
+      m_fullCycles++;
+      affected.resize(ff);
+      for(unsigned i=0; i<ff; i++){
+        affected[i]=i;
+      }
+    }else{
+      // Program order is a topological order
+      std::sort(gates.begin(), gates.end());
+      uint64_t *values=m_values.data();
+      for(uint32_t g : gates){
+        values[gateBase+g]=~(values[srcA[g]] & values[srcB[g]]);
+      }
+      m_evaluated+=gates.size();
+      m_incrementalCycles++;
+    }
+
+    // Work out the new differences before clearing the old ones
+    std::vector<uint64_t> &next=m_next;
+    next.resize(affected.size());
+    for(unsigned i=0; i<affected.size(); i++){
+      next[i]=m_values[ffSrcs[affected[i]]]^baseline(t+1, affected[i]);
+    }
+    for(uint32_t f : diffs){
+      m_diff[f]=0;
+    }
+    diffs.clear();
+    for(unsigned i=0; i<affected.size(); i++){
+      uint32_t f=affected[i];
+      if(next[i] && !m_diff[f]){
+        diffs.push_back(f);
+      }
+      m_diff[f]=next[i];
+    }
+  }
+
+  /*! Advance runs ids[0..lanes) from cycle begin to end, one per lane.
+
+    laneDiffs[id] holds the flip-flops where the run differs from the
+    baseline, and is updated to cycle end (or emptied on convergence).
+  */
+  void runPass(
+               unsigned begin, unsigned end,
+               const unsigned *ids, unsigned lanes,
+               std::vector<std::vector<uint32_t> > &laneDiffs,
+               std::vector<unsigned> &converged
+               )
+  {
+    // Windows lie within one segment
+    loadSegment(begin/m_interval);
+
+    std::vector<uint32_t> diffs;
+    for(unsigned lane=0; lane<lanes; lane++){
+      for(uint32_t f : laneDiffs[ids[lane]]){
+        if(!m_diff[f])
+          diffs.push_back(f);
+        m_diff[f]|=uint64_t(1)<<lane;
+      }
+    }
+
+    uint64_t wasLive=lanes==64 ? ~uint64_t(0) : (uint64_t(1)<<lanes)-1;
+    for(unsigned t=begin; t<end && !diffs.empty(); t++){
+      step(t, diffs);
+      uint64_t live=0;
+      for(uint32_t f : diffs){
+        live|=m_diff[f];
+      }
+      for(uint64_t gone=wasLive&~live; gone; gone&=gone-1){
+        converged[ids[__builtin_ctzll(gone)]]=t+1;
+      }
+      wasLive=live;
+    }
+
+    for(unsigned lane=0; lane<lanes; lane++){
+      laneDiffs[ids[lane]].clear();
+    }
+    for(uint32_t f : diffs){
+      for(uint64_t bits=m_diff[f]; bits; bits&=bits-1){
+        laneDiffs[ids[__builtin_ctzll(bits)]].push_back(f);
+      }
+      m_diff[f]=0;
+    }
+  }
+
+public:
+  /*! Record the baseline run of netlist from initialState.
+
+    The trajectory is (clockCycles+1)*flipFlopCount bits. If that is
+    over maxBaselineBytes, it is cut into segments of about
+    sqrt(clockCycles) cycles, and each Run re-simulates the baseline
+    once more as it goes; if even that does not fit, it throws.
+  */
+  CircuitSimWhatIf(
+                   const CircuitSimCompiled &netlist,
+                   const std::vector<bool> &initialState,
+                   unsigned clockCycles,
+                   double maxConeFraction=0.25,
+                   uint64_t maxBaselineBytes=uint64_t(1)<<28
+                   )
+    : m_netlist(netlist)
+    , m_clockCycles(clockCycles)
+    , m_maxConeFraction(maxConeFraction)
+    , m_stateWords((netlist.flipFlopCount()+63)/64)
+    , m_interval(baselineInterval(clockCycles, m_stateWords, maxBaselineBytes))
+    , m_checkpoints(uint64_t(clockCycles/m_interval+1)*m_stateWords, 0)
+    , m_final(m_stateWords, 0)
+    , m_states(uint64_t(m_interval+1)*m_stateWords, 0)
+    , m_segment(0)
+    , m_simValues(netlist.slotCount(), 0)
+    , m_simScratch(netlist.flipFlopCount())
+    , m_values(netlist.slotCount(), 0)
+    , m_diff(netlist.flipFlopCount(), 0)
+    , m_mark(netlist.slotCount(), 0)
+    , m_epoch(0)
+    , m_incrementalCycles(0)
+    , m_fullCycles(0)
+    , m_evaluated(0)
+  {
+    unsigned ff=netlist.flipFlopCount();
+    if(initialState.size()!=ff)
+      throw std::runtime_error("CircuitSimWhatIf::CircuitSimWhatIf - state size is inconsistent.");
+
+    std::vector<uint32_t> sources, readers;
+    for(unsigned i=0; i<netlist.gateCount(); i++){
+      sources.push_back(netlist.srcA()[i]);
+      readers.push_back(i);
+      if(netlist.srcB()[i]!=netlist.srcA()[i]){
+        sources.push_back(netlist.srcB()[i]);
+        readers.push_back(i);
+      }
+    }
+    buildCsr(netlist.slotCount(), sources, readers, m_fanoutBegin, m_fanout);
+
+    std::vector<uint32_t> latchers(ff);
+    for(unsigned i=0; i<ff; i++){
+      latchers[i]=i;
+    }
+    buildCsr(netlist.slotCount(), netlist.flipFlopSrcs(), latchers, m_latchBegin, m_latch);
+
+    // The first segment is left loaded, which is all of it if it fits
+    for(unsigned i=0; i<ff; i++){
+      m_simValues[i]=initialState[i] ? 0xFF : 0;
+    }
+    for(unsigned t=0; t<=clockCycles; t++){
+      if(t%m_interval==0){
+        storeState(&m_checkpoints[uint64_t(t/m_interval)*m_stateWords]);
+      }
+      if(t<=m_interval){
+        storeState(&m_states[uint64_t(t)*m_stateWords]);
+      }
+      if(t<clockCycles){
+        m_netlist.Step(m_simValues.data(), m_simScratch.data());
+      }
+    }
+    storeState(&m_final[0]);
+  }
+
+  /*! Cycles between stored baseline states, as chosen for these sizes.
+
+    clockCycles (or 1) if the whole trajectory fits in maxBytes, as then
+    one segment is the whole run.
+  */
+  static unsigned baselineInterval(unsigned clockCycles, unsigned stateWords, uint64_t maxBytes)
+  {
+    uint64_t stateBytes=std::max(1u, stateWords)*sizeof(uint64_t);
+    // Checkpoints, segment and final state
+    auto bytes=[&](uint64_t interval){
+      return (clockCycles/interval+1 + interval+1 + 1)*stateBytes;
+    };
+    unsigned interval=std::max(1u, clockCycles);
+    if(bytes(interval)>maxBytes){
+      interval=std::max(1u, unsigned(std::ceil(std::sqrt(double(clockCycles)))));
+      if(bytes(interval)>maxBytes)
+        throw std::runtime_error("CircuitSimWhatIf - the baseline needs "+std::to_string(bytes(interval))
+                                 +" bytes even in segments, more than the limit of "+std::to_string(maxBytes)+".");
+    }
+    return interval;
+  }
+
+  //! Cycles between stored baseline states; clockCycles if it is all kept
+  unsigned BaselineInterval() const
+  { return m_interval; }
+
+  //! Bytes held for the baseline trajectory
+  uint64_t BaselineBytes() const
+  { return (m_checkpoints.size()+m_final.size()+m_states.size())*sizeof(uint64_t); }
+
+  unsigned flipFlopCount() const
+  { return m_netlist.flipFlopCount(); }
+
+  //! Final state of the unperturbed run
+  std::vector<bool> BaselineOutput() const
+  {
+    std::vector<bool> res(flipFlopCount());
+    for(unsigned i=0; i<res.size(); i++){
+      res[i]=finalBit(m_final, i);
+    }
+    return res;
+  }
+
+  /*! Final states for each perturbation.
+
+    Each perturbation lists the initial flip-flops to invert. Results go
+    to outputs[i], and convergedCycle[i] (if given) is the cycle at which
+    run i rejoined the baseline, or clockCycles+1 if it never did.
+  */
+  void Run(
+           const std::vector<std::vector<uint32_t> > &perturbations,
+           std::vector<std::vector<bool> > &outputs,
+           std::vector<unsigned> *convergedCycle=0
+           )
+  {
+    unsigned ff=flipFlopCount();
+    unsigned count=perturbations.size();
+    std::vector<unsigned> converged(count, m_clockCycles+1);
+
+    // Differences from the baseline, normalised so a bit flipped twice cancels
+    std::vector<std::vector<uint32_t> > laneDiffs(count);
+    std::vector<uint32_t> live;
+    for(unsigned i=0; i<count; i++){
+      std::vector<uint32_t> d(perturbations[i]);
+      for(uint32_t f : d){
+        if(f>=ff)
+          throw std::runtime_error("CircuitSimWhatIf::Run - flip-flop index out of range.");
+      }
+      std::sort(d.begin(), d.end());
+      for(unsigned j=0; j<d.size(); ){
+        unsigned k=j;
+        while(k<d.size() && d[k]==d[j]){
+          k++;
+        }
+        if((k-j)%2){
+          laneDiffs[i].push_back(d[j]);
+        }
+        j=k;
+      }
+      if(laneDiffs[i].empty()){
+        converged[i]=0;
+      }else{
+        live.push_back(i);
+      }
+    }
+
+    // Many perturbations die out within a few cycles, so survivors are
+    // repacked into full groups over windows of doubling length.
+    unsigned begin=0, window=8;
+    while(begin<m_clockCycles && !live.empty()){
+      uint64_t segmentEnd=(uint64_t(begin)/m_interval+1)*m_interval;
+      unsigned end=std::min<uint64_t>(std::min<uint64_t>(m_clockCycles, segmentEnd), uint64_t(begin)+window);
+      for(unsigned done=0; done<live.size(); done+=64){
+        unsigned lanes=std::min<unsigned>(64, live.size()-done);
+        runPass(begin, end, &live[done], lanes, laneDiffs, converged);
+      }
+      live.erase(std::remove_if(live.begin(), live.end(), [&](unsigned i){ return laneDiffs[i].empty(); }), live.end());
+      begin=end;
+      window*=2;
+    }
+
+    outputs.resize(count);
+    for(unsigned i=0; i<count; i++){
+      std::vector<bool> &state=outputs[i];
+      state.resize(ff);
+      for(unsigned j=0; j<ff; j++){
+        state[j]=finalBit(m_final, j);
+      }
+      for(uint32_t f : laneDiffs[i]){
+        state[f]=!state[f];
+      }
+    }
+    if(convergedCycle)
+      convergedCycle->swap(converged);
+  }
+
+  //! Cycles that only evaluated the affected region
+  uint64_t IncrementalCycles() const
+  { return m_incrementalCycles; }
+
+  //! Cycles that fell back to evaluating every gate
+  uint64_t FullCycles() const
+  { return m_fullCycles; }
+
+  //! Average fraction of the netlist evaluated per simulated cycle
+  double ActivityFactor() const
+  {
+    uint64_t cycles=m_incrementalCycles+m_fullCycles;
+    return cycles && m_netlist.gateCount() ? double(m_evaluated)/(double(cycles)*m_netlist.gateCount()) : 0.0;
+  }
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef env_options_hpp
+#define env_options_hpp
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+/*! Engine settings can be overridden from the environment.
+
+  Clients only see puzzles through the registrar, so this is the one
+  way of choosing engines and tuning parameters without rebuilding.
+*/
+inline std::string EnvOption(const char *name, const std::string &def)
+{
+  const char *value=getenv(name);
+  return value ? std::string(value) : def;
+}
+
+inline unsigned EnvOption(const char *name, unsigned def)
+{
+  const char *value=getenv(name);
+  return value ? unsigned(strtoul(value, 0, 0)) : def;
+}
+
+inline uint64_t EnvOption(const char *name, uint64_t def)
+{
+  const char *value=getenv(name);
+  return value ? uint64_t(strtoull(value, 0, 0)) : def;
+}
+
+inline double EnvOption(const char *name, double def)
+{
+  const char *value=getenv(name);
+  return value ? strtod(value, 0) : def;
+}
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef life_bitboard_hpp
+#define life_bitboard_hpp
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*! A Life board held as 64 cells per word.
+
+  Each row is stored as a guard word followed by (n+63)/64 cell words
+  and a trailing guard word, with bit x of the row at word x/64, bit
+  x%64. The torus wrap is handled with ghost cells: bit 63 of the
+  leading guard holds cell n-1, and bit n (just past the last cell)
+  holds cell 0. Shifting a row by one bit in either direction then
+  picks up the wrapped neighbour with no special cases, whatever n is.
+
+  A board can also be given fewer rows than columns, for engines that
+  work on horizontal strips of a full board.
+*/
+class LifeBitboard
+{
+private:
+  unsigned m_n;
+  unsigned m_rows;
+  unsigned m_words;   // Cell words per row
+  unsigned m_stride;  // Words per row, including guards
+  std::vector<uint64_t> m_cells;
+
+public:
+  LifeBitboard(unsigned n)
+    : m_n(n)
+    , m_rows(n)
+    , m_words((n+63)/64)
+    , m_stride(m_words+2)
+    , m_cells(uint64_t(n)*m_stride, 0)
+  {}
+
+  LifeBitboard(unsigned n, unsigned rows)
+    : m_n(n)
+    , m_rows(rows)
+    , m_words((n+63)/64)
+    , m_stride(m_words+2)
+    , m_cells(uint64_t(rows)*m_stride, 0)
+  {}
+
+  //! Cells per row
+  unsigned n() const
+  { return m_n; }
+
+  unsigned rows() const
+  { return m_rows; }
+
+  unsigned words() const
+  { return m_words; }
+
+  //! Cell words of row y; row(y)[-1] and row(y)[words()] are the guards
+  uint64_t *row(unsigned y)
+  { return &m_cells[uint64_t(y)*m_stride+1]; }
+
+  const uint64_t *row(unsigned y) const
+  { return &m_cells[uint64_t(y)*m_stride+1]; }
+
+  bool Get(unsigned x, unsigned y) const
+  { return (row(y)[x/64]>>(x%64))&1; }
+
+  //! Clear padding past cell n-1 and refresh the ghost cells of row r
+  static void FixRow(uint64_t *r, unsigned n)
+  {
+    unsigned words=(n+63)/64;
+    if(n%64){
+      r[words-1] &= (uint64_t(1)<<(n%64))-1;
+    }
+    r[words]=0;
+    r[n/64] |= (r[0]&1)<<(n%64);
+    r[-1]=((r[(n-1)/64]>>((n-1)%64))&1)<<63;
+  }
+
+  void FixRow(unsigned y)
+  { FixRow(row(y), m_n); }
+
+  void Load(const std::vector<bool> &state)
+  {
+    if(m_rows!=m_n || state.size()!=uint64_t(m_n)*m_n)
+      throw std::runtime_error("LifeBitboard::Load - state size is inconsistent.");
+    std::fill(m_cells.begin(), m_cells.end(), 0);
+    for(unsigned y=0; y<m_n; y++){
+      uint64_t *r=row(y);
+      for(unsigned x=0; x<m_n; x++){
+        r[x/64] |= uint64_t(state[uint64_t(y)*m_n+x])<<(x%64);
+      }
+      FixRow(y);
+    }
+  }
+
+  void Store(std::vector<bool> &state) const
+  {
+    if(m_rows!=m_n)
+      throw std::runtime_error("LifeBitboard::Store - board is not square.");
+    state.resize(uint64_t(m_n)*m_n);
+    for(unsigned y=0; y<m_n; y++){
+      const uint64_t *r=row(y);
+      for(unsigned x=0; x<m_n; x++){
+        state[uint64_t(y)*m_n+x]=(r[x/64]>>(x%64))&1;
+      }
+    }
+  }
+};
+
+/*! Next generation of cells, 64 at a time.
+
+  Inputs are the above/current/below row words with their west and
+  east neighbours already shifted in. Neighbour counts are summed with
+  full adders: ones = the parity of the three column sums' low bits,
+  and a cell lives iff exactly one "two" is present among the carries
+  and (ones or the cell itself) is set, i.e. the count is 3, or 2 with
+  the cell alive.
+*/
+template<class T>
+inline T LifeBitboardRule(T aw, T ac, T ae, T cw, T cc, T ce, T bw, T bc, T be)
+{
+  // Column sums of three (above, below) and two (current row)
+  T aLo=aw^ac^ae, aHi=(aw&ac)|(ae&(aw^ac));
+  T bLo=bw^bc^be, bHi=(bw&bc)|(be&(bw^bc));
+  T cLo=cw^ce, cHi=cw&ce;
+
+  T ones=aLo^bLo^cLo;
+  T carry=(aLo&bLo)|(cLo&(aLo^bLo));
+
+  // Exactly one of the four weight-two bits
+  T p=aHi^bHi, q=cHi^carry;
+  T exactlyOne=(p^q) & ~((aHi&bHi)|(cHi&carry));
+
+  return exactlyOne & (ones|cc);
+}
+
+//! Cells whose neighbour count, given as bit-planes, is some k in TMask
+template<unsigned TMask, unsigned K=0, bool TSet=((TMask>>K)&1)!=0>
+struct LifeCountIn
+{
+  template<class T>
+  static T Test(T ones, T twos, T fours, T eights)
+  { return LifeCountIn<TMask,K+1,((TMask>>(K+1))&1)!=0>::Test(ones, twos, fours, eights); }
+};
+
+template<unsigned TMask, unsigned K>
+struct LifeCountIn<TMask,K,true>
+{
+  template<class T>
+  static T Test(T ones, T twos, T fours, T eights)
+  {
+    T eq=((K&1) ? ones : ~ones) & ((K&2) ? twos : ~twos)
+      & ((K&4) ? fours : ~fours) & ((K&8) ? eights : ~eights);
+    return eq | LifeCountIn<TMask,K+1,((TMask>>(K+1))&1)!=0>::Test(ones, twos, fours, eights);
+  }
+};
+
+template<unsigned TMask>
+struct LifeCountIn<TMask,9,false>
+{
+  template<class T>
+  static T Test(T ones, T, T, T)
+  { return ones^ones; }
+};
+
+/*! An outer-totalistic rule, with bit k of TBirth (TSurvive) set if a
+  dead (live) cell with k live neighbours is alive next generation.
+
+  Neighbour counts are summed to four bit-planes with full adders, and
+  the rule is the OR of a count==k test for each k in the masks. The
+  masks are template arguments, so this expands to straight-line logic
+  for just the counts the rule uses. B3/S23 goes to LifeBitboardRule, which
+  gets away with fewer operations by knowing the rule.
+*/
+template<unsigned TBirth, unsigned TSurvive>
+struct LifeRule
+{
+  enum : unsigned{ Birth=TBirth, Survive=TSurvive };
+
+  template<class T>
+  static T Next(T aw, T ac, T ae, T cw, T cc, T ce, T bw, T bc, T be)
+  {
+    if(TBirth==(1u<<3) && TSurvive==((1u<<2)|(1u<<3)))
+      return LifeBitboardRule(aw, ac, ae, cw, cc, ce, bw, bc, be);
+
+    T aLo=aw^ac^ae, aHi=(aw&ac)|(ae&(aw^ac));
+    T bLo=bw^bc^be, bHi=(bw&bc)|(be&(bw^bc));
+    T cLo=cw^ce, cHi=cw&ce;
+
+    // count = ones + 2*twos + 4*fours + 8*eights
+    T ones=aLo^bLo^cLo;
+    T carry=(aLo&bLo)|(cLo&(aLo^bLo));
+    T hiLo=aHi^bHi^cHi, hiHi=(aHi&bHi)|(cHi&(aHi^bHi));
+    T twos=hiLo^carry;
+    T twosCarry=hiLo&carry;
+    T fours=hiHi^twosCarry, eights=hiHi&twosCarry;
+
+    T born=LifeCountIn<TBirth>::Test(ones, twos, fours, eights);
+    T survive=LifeCountIn<TSurvive>::Test(ones, twos, fours, eights);
+    return (cc&survive) | (~cc&born);
+  }
+};
+
+typedef LifeRule<1u<<3, (1u<<2)|(1u<<3)> LifeConwayRule;
+
+/*! Words [begin,end) of the next generation of row c.
+
+  a and b are the rows above and below; all three must have valid
+  guard and ghost cells. With TTrackChanges, returns the OR of the new
+  words XORed with what they overwrote, otherwise 0.
+*/
+template<bool TTrackChanges, class TRule=LifeConwayRule>
+inline uint64_t LifeBitboardStepWords(const uint64_t *a, const uint64_t *c, const uint64_t *b, uint64_t *d, unsigned begin, unsigned end)
+{
+  uint64_t changes=0;
+  unsigned i=begin;
+#ifdef __AVX2__
+  __m256i changes4=_mm256_setzero_si256();
+  for(; i+4<=end; i+=4){
+#define LIFE_BITBOARD_LOAD(p, o) _mm256_loadu_si256((const __m256i*)((p)+(o)+i))
+#define LIFE_BITBOARD_WEST(p) _mm256_or_si256(_mm256_slli_epi64(LIFE_BITBOARD_LOAD(p,0),1), _mm256_srli_epi64(LIFE_BITBOARD_LOAD(p,-1),63))
+#define LIFE_BITBOARD_EAST(p) _mm256_or_si256(_mm256_srli_epi64(LIFE_BITBOARD_LOAD(p,0),1), _mm256_slli_epi64(LIFE_BITBOARD_LOAD(p,1),63))
+    __m256i aw=LIFE_BITBOARD_WEST(a), ac=LIFE_BITBOARD_LOAD(a,0), ae=LIFE_BITBOARD_EAST(a);
+    __m256i cw=LIFE_BITBOARD_WEST(c), cc=LIFE_BITBOARD_LOAD(c,0), ce=LIFE_BITBOARD_EAST(c);
+    __m256i bw=LIFE_BITBOARD_WEST(b), bc=LIFE_BITBOARD_LOAD(b,0), be=LIFE_BITBOARD_EAST(b);
+    __m256i res=TRule::Next(aw, ac, ae, cw, cc, ce, bw, bc, be);
+    if(TTrackChanges){
+      changes4=_mm256_or_si256(changes4, _mm256_xor_si256(res, LIFE_BITBOARD_LOAD(d,0)));
+    }
+#undef LIFE_BITBOARD_LOAD
+#undef LIFE_BITBOARD_WEST
+#undef LIFE_BITBOARD_EAST
+    _mm256_storeu_si256((__m256i*)(d+i), res);
+  }
+  if(TTrackChanges){
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, changes4);
+    changes=lanes[0]|lanes[1]|lanes[2]|lanes[3];
+  }
+#endif
+  for(; i<end; i++){
+    uint64_t aw=(a[i]<<1)|((a-1)[i]>>63), ae=(a[i]>>1)|(a[i+1]<<63);
+    uint64_t cw=(c[i]<<1)|((c-1)[i]>>63), ce=(c[i]>>1)|(c[i+1]<<63);
+    uint64_t bw=(b[i]<<1)|((b-1)[i]>>63), be=(b[i]>>1)|(b[i+1]<<63);
+    uint64_t res=TRule::Next(aw, a[i], ae, cw, c[i], ce, bw, b[i], be);
+    if(TTrackChanges){
+      changes|=res^d[i];
+    }
+    d[i]=res;
+  }
+  return changes;
+}
+
+//! The full-adder kernel, as used by the engines unless told otherwise
+template<class TRule=LifeConwayRule>
+struct LifeBitwiseKernel
+{
+  typedef TRule Rule;
+
+  template<bool TTrackChanges>
+  uint64_t StepWords(const uint64_t *a, const uint64_t *c, const uint64_t *b, uint64_t *d, unsigned begin, unsigned end) const
+  { return LifeBitboardStepWords<TTrackChanges,TRule>(a, c, b, d, begin, end); }
+};
+
+/*! Compute rows [yBegin,yEnd) of dst as the generation after src.
+
+  dst rows get their padding and ghost cells fixed, so dst is ready to
+  be the source of the next step once every row has been written.
+  TKernel is anything with the StepWords interface of LifeBitwiseKernel.
+*/
+template<class TKernel=LifeBitwiseKernel<> >
+inline void LifeBitboardStepRows(const LifeBitboard &src, LifeBitboard &dst, unsigned yBegin, unsigned yEnd, const TKernel &kernel=TKernel())
+{
+  unsigned n=src.n();
+  for(unsigned y=yBegin; y<yEnd; y++){
+    const uint64_t *a=src.row(y==0 ? n-1 : y-1);
+    const uint64_t *b=src.row(y+1==n ? 0 : y+1);
+    kernel.template StepWords<false>(a, src.row(y), b, dst.row(y), 0, src.words());
+    dst.FixRow(y);
+  }
+}
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef life_checkpoint_hpp
+#define life_checkpoint_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "puzzler/puzzles/life.hpp"
+#include "puzzler/core/streams/file_in_stream.hpp"
+#include "puzzler/core/streams/file_out_stream.hpp"
+
+#include "life_bitboard.hpp"
+
+/*! A Life board part way through a run, as written to disk.
+
+  The cells are the bitboard words, run-length coded: alternating
+  counts of zero words and of non-zero words (as varints), with the
+  non-zero words following their count as 8 little-endian bytes. A
+  young random board costs about a bit per cell, the same as an input,
+  and a settled one mostly empty space costs next to nothing. Encoding
+  is a single pass over the words, and the whole thing goes through
+  PersistContext as one string, so one write per checkpoint.
+
+  inputHash identifies the input the run started from, so a checkpoint
+  is only resumed by the run it came from.
+*/
+class LifeCheckpoint
+  : public puzzler::Persistable
+{
+private:
+  std::string m_format;
+  uint32_t m_n;
+  uint32_t m_steps;
+  uint32_t m_generation;
+  uint64_t m_inputHash;
+  std::string m_cells;
+
+  // Non-zero words are buffered in runs of at most this many
+  enum{ MaxLiterals=4096 };
+
+  static void putVarint(std::string &dst, uint64_t x)
+  {
+    while(x>=0x80){
+      dst.push_back(char(0x80|(x&0x7F)));
+      x>>=7;
+    }
+    dst.push_back(char(x));
+  }
+
+  uint64_t getVarint(size_t &pos) const
+  {
+    uint64_t x=0;
+    for(unsigned shift=0; shift<64; shift+=7){
+      if(pos>=m_cells.size())
+        break;
+      uint8_t b=m_cells[pos++];
+      x|=uint64_t(b&0x7F)<<shift;
+      if(!(b&0x80))
+        return x;
+    }
+    throw std::runtime_error("LifeCheckpoint::Restore - cells are corrupt.");
+  }
+
+public:
+  LifeCheckpoint()
+    : m_format("life.checkpoint.v0")
+    , m_n(0)
+    , m_steps(0)
+    , m_generation(0)
+    , m_inputHash(0)
+  {}
+
+  LifeCheckpoint(uint32_t steps, uint64_t inputHash)
+    : m_format("life.checkpoint.v0")
+    , m_n(0)
+    , m_steps(steps)
+    , m_generation(0)
+    , m_inputHash(inputHash)
+  {}
+
+  virtual void Persist(puzzler::PersistContext &ctxt) override
+  {
+    ctxt.SendOrRecv(m_format, "life.checkpoint.v0");
+    ctxt.SendOrRecv(m_n);
+    ctxt.SendOrRecv(m_steps);
+    ctxt.SendOrRecv(m_generation);
+    ctxt.SendOrRecv(m_inputHash);
+    ctxt.SendOrRecv(m_cells);
+  }
+
+  unsigned n() const
+  { return m_n; }
+
+  //! Total generations of the run
+  unsigned steps() const
+  { return m_steps; }
+
+  //! Generation the board is at
+  unsigned generation() const
+  { return m_generation; }
+
+  uint64_t inputHash() const
+  { return m_inputHash; }
+
+  //! Encoded size of the cells in bytes
+  size_t cellBytes() const
+  { return m_cells.size(); }
+
+  void Capture(const LifeBitboard &board, unsigned generation)
+  {
+    m_n=board.n();
+    m_generation=generation;
+    m_cells.clear();
+
+    unsigned words=board.words();
+    uint64_t zeros=0;
+    std::vector<uint64_t> literals;
+    auto flush=[&](){
+      putVarint(m_cells, zeros);
+      putVarint(m_cells, literals.size());
+      size_t at=m_cells.size();
+      m_cells.resize(at+8*literals.size());
+      char *dst=&m_cells[at];
+      for(uint64_t w : literals){
+        for(unsigned i=0; i<8; i++){
+          *dst++=char(w>>(8*i));
+        }
+      }
+      zeros=0;
+      literals.clear();
+    };
+    for(unsigned y=0; y<board.rows(); y++){
+      const uint64_t *r=board.row(y);
+      for(unsigned i=0; i<words; i++){
+        if(r[i]==0){
+          if(!literals.empty())
+            flush();
+          zeros++;
+        }else{
+          literals.push_back(r[i]);
+          if(literals.size()==MaxLiterals)
+            flush();
+        }
+      }
+    }
+    flush();
+  }
+
+  void Restore(LifeBitboard &board) const
+  {
+    if(board.n()!=m_n || board.rows()!=m_n)
+      throw std::runtime_error("LifeCheckpoint::Restore - board size does not match.");
+
+    unsigned words=board.words();
+    uint64_t total=uint64_t(m_n)*words, done=0;
+    unsigned y=0, x=0;
+    auto put=[&](uint64_t w){
+      board.row(y)[x]=w;
+      if(++x==words){
+        x=0;
+        y++;
+      }
+    };
+    size_t pos=0;
+    while(done<total){
+      uint64_t zeros=getVarint(pos), count=getVarint(pos);
+      if(zeros+count>total-done || pos+8*count>m_cells.size())
+        throw std::runtime_error("LifeCheckpoint::Restore - cells are corrupt.");
+      done+=zeros+count;
+      for(; zeros>0; zeros--){
+        put(0);
+      }
+      for(; count>0; count--){
+        uint64_t w=0;
+        for(unsigned i=0; i<8; i++){
+          w|=uint64_t(uint8_t(m_cells[pos++]))<<(8*i);
+        }
+        put(w);
+      }
+    }
+    if(pos!=m_cells.size())
+      throw std::runtime_error("LifeCheckpoint::Restore - cells are corrupt.");
+    for(unsigned r=0; r<m_n; r++){
+      board.FixRow(r);
+    }
+  }
+
+  /*! Write to path, via a temporary file so an existing checkpoint survives a crash.
+
+    The temporary file gets a unique name from mkstemp next to path, so
+    it can't be a symlink planted by someone else, and it and the rename
+    are synced so that the checkpoint survives the machine going down
+    as well as the process.
+  */
+  void Save(const std::string &path)
+  {
+    std::string tmp=path+".XXXXXX";
+    int fd=mkstemp(&tmp[0]);
+    if(fd==-1)
+      throw std::runtime_error("LifeCheckpoint::Save - couldn't create a temporary file for '"+path+"'.");
+    try{
+      puzzler::FileOutStream dst(fd);
+      puzzler::PersistContext ctxt(&dst, true);
+      Persist(ctxt);
+      dst.Sync();
+    }catch(...){
+      unlink(tmp.c_str());
+      throw;
+    }
+    if(rename(tmp.c_str(), path.c_str())!=0){
+      unlink(tmp.c_str());
+      throw std::runtime_error("LifeCheckpoint::Save - couldn't rename '"+tmp+"' to '"+path+"'.");
+    }
+
+    size_t slash=path.find_last_of('/');
+    std::string dir=slash==std::string::npos ? "." : path.substr(0, slash+1);
+    int dirFd=open(dir.c_str(), O_RDONLY|O_DIRECTORY);
+    if(dirFd==-1)
+      throw std::runtime_error("LifeCheckpoint::Save - couldn't open directory '"+dir+"'.");
+    int synced=fsync(dirFd);
+    close(dirFd);
+    if(synced!=0)
+      throw std::runtime_error("LifeCheckpoint::Save - couldn't sync directory '"+dir+"'.");
+  }
+
+  //! Read from path, returning false if there is no such file
+  bool Load(const std::string &path)
+  {
+    struct stat info;
+    if(stat(path.c_str(), &info)!=0)
+      return false;
+    puzzler::FileInStream src(path);
+    puzzler::PersistContext ctxt(&src, false);
+    Persist(ctxt);
+    return true;
+  }
+
+  /*! An input that starts from this board and runs the remaining steps.
+
+    Lets benchmarks of late, settled generations skip the early ones.
+  */
+  std::shared_ptr<puzzler::LifeInput> MakeInput(const puzzler::Puzzle *puzzle) const
+  {
+    LifeBitboard board(m_n);
+    Restore(board);
+
+    auto input=std::make_shared<puzzler::LifeInput>(puzzle, m_n);
+    input->n=m_n;
+    input->steps=m_steps-m_generation;
+    board.Store(input->state);
+    return input;
+  }
+};
+
+/*! Writes a checkpoint every interval generations of a run.
+
+  Engines report generations counted from wherever they started, and
+  Rebase says where that is in the whole run.
+*/
+class LifeCheckpointWriter
+{
+private:
+  std::string m_path;
+  unsigned m_interval;
+  unsigned m_steps;
+  uint64_t m_inputHash;
+  unsigned m_base;
+  unsigned m_next;
+
+  unsigned m_written;
+  double m_seconds;
+
+public:
+  //! An empty path or interval of 0 writes nothing
+  LifeCheckpointWriter(const std::string &path, unsigned interval, unsigned steps, uint64_t inputHash, unsigned first)
+    : m_path(path)
+    , m_interval(interval)
+    , m_steps(steps)
+    , m_inputHash(inputHash)
+    , m_base(first)
+    , m_next(interval ? (first/interval+1)*interval : 0)
+    , m_written(0)
+    , m_seconds(0)
+  {}
+
+  bool enabled() const
+  { return !m_path.empty() && m_interval>0; }
+
+  //! Generations reported from now on are counted from generation base
+  void Rebase(unsigned base)
+  { m_base=base; }
+
+  void Observe(const LifeBitboard &board, unsigned generation)
+  {
+    unsigned g=m_base+generation;
+    if(!enabled() || g<m_next || g>=m_steps)
+      return;
+    puzzler::timestamp_t start=puzzler::now();
+    LifeCheckpoint checkpoint(m_steps, m_inputHash);
+    checkpoint.Capture(board, g);
+    checkpoint.Save(m_path);
+    m_next=(g/m_interval+1)*m_interval;
+    m_written++;
+    m_seconds+=(puzzler::now()-start)*1e-9;
+  }
+
+  unsigned Written() const
+  { return m_written; }
+
+  //! Time spent writing checkpoints
+  double Seconds() const
+  { return m_seconds; }
+};
+
+#endif
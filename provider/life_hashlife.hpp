@@ -0,0 +1,436 @@
+#ifndef life_hashlife_hpp
+#define life_hashlife_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "life_bitboard.hpp"
+
+/*! Hashlife: memoised quadtree evolution.
+
+  Nodes are canonical, so identical regions anywhere in space or time
+  share one node, and the successor of each node is computed once. A
+  level L node is 2^L cells square; level 3 nodes are leaves holding
+  8x8 cells, and the successor of a level L node is its centre half,
+  2^j generations on, for any j <= L-2.
+
+  The torus is the periodic tiling of the board, so Advance lays the
+  board out periodically over a square big enough for the light cone,
+  and reads the board back from the centre of the result. The tiling
+  repeats exactly, so the copies cost nothing extra once canonicalised.
+  Jumps are powers of two, up to a quarter of that square.
+
+  The node store is bounded: when it passes maxNodes at a safe point,
+  nodes not reachable from the computation in progress are swept and
+  reused, and memo entries referring to them dropped. Ids are stable
+  across collection, so only live temporaries need to be on m_roots.
+*/
+class LifeHashlife
+{
+private:
+  // No implementation for either
+  LifeHashlife(const LifeHashlife &); // = delete;
+  LifeHashlife &operator=(const LifeHashlife &); // = delete;
+
+  // Enums rather than static consts, as they are passed by reference
+  enum : uint32_t{ Free=0xFFFFFFFFu, None=0xFFFFFFFFu };
+  enum{ LeafLevel=3 };
+
+  //! Children are nw,ne,sw,se; leaves keep their 64 cells in child[0..1]
+  struct Node
+  {
+    uint32_t child[4];
+    uint32_t level;
+  };
+
+  struct Memo
+  {
+    uint32_t key;
+    uint32_t step;
+    uint32_t value;
+  };
+
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_free;
+  unsigned m_live;
+
+  std::vector<uint32_t> m_table;   // Canonical nodes, open addressed, None is empty
+  std::vector<Memo> m_memo;        // (node,j) -> successor, open addressed
+  unsigned m_memoUsed;
+
+  std::vector<uint32_t> m_roots;   // Temporaries held by callers
+  unsigned m_maxNodes;
+  unsigned m_gcThreshold;
+
+  uint64_t m_collections;
+  uint64_t m_memoHits;
+  uint64_t m_memoMisses;
+
+  static uint64_t hashNode(uint32_t level, const uint32_t *child)
+  {
+    uint64_t h=level*0x9E3779B97F4A7C15ull;
+    for(unsigned i=0; i<4; i++){
+      h=(h^child[i])*0xFF51AFD7ED558CCDull;
+      h^=h>>32;
+    }
+    return h;
+  }
+
+  static uint64_t hashMemo(uint32_t key, uint32_t step)
+  {
+    uint64_t h=(uint64_t(key)<<8|step)*0xC4CEB9FE1A85EC53ull;
+    return h^(h>>29);
+  }
+
+  void tableInsert(uint32_t id)
+  {
+    uint64_t mask=m_table.size()-1;
+    uint64_t i=hashNode(m_nodes[id].level, m_nodes[id].child)&mask;
+    while(m_table[i]!=None){
+      i=(i+1)&mask;
+    }
+    m_table[i]=id;
+  }
+
+  void rebuildTable(size_t size)
+  {
+    m_table.assign(size, None);
+    for(uint32_t id=0; id<m_nodes.size(); id++){
+      if(m_nodes[id].level!=Free)
+        tableInsert(id);
+    }
+  }
+
+  void memoInsert(uint32_t key, uint32_t step, uint32_t value)
+  {
+    if(2*(m_memoUsed+1) > m_memo.size()){
+      std::vector<Memo> old;
+      old.swap(m_memo);
+      m_memo.assign(std::max<size_t>(1024, 2*old.size()), Memo{None,0,None});
+      m_memoUsed=0;
+      for(const Memo &e : old){
+        if(e.key!=None)
+          memoInsert(e.key, e.step, e.value);
+      }
+    }
+    uint64_t mask=m_memo.size()-1;
+    uint64_t i=hashMemo(key, step)&mask;
+    while(m_memo[i].key!=None){
+      i=(i+1)&mask;
+    }
+    m_memo[i]=Memo{key, step, value};
+    m_memoUsed++;
+  }
+
+  uint32_t memoFind(uint32_t key, uint32_t step) const
+  {
+    if(m_memo.empty())
+      return None;
+    uint64_t mask=m_memo.size()-1;
+    uint64_t i=hashMemo(key, step)&mask;
+    while(m_memo[i].key!=None){
+      if(m_memo[i].key==key && m_memo[i].step==step)
+        return m_memo[i].value;
+      i=(i+1)&mask;
+    }
+    return None;
+  }
+
+  uint32_t make(uint32_t level, uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3)
+  {
+    uint32_t child[4]={c0, c1, c2, c3};
+    uint64_t mask=m_table.size()-1;
+    uint64_t i=hashNode(level, child)&mask;
+    while(m_table[i]!=None){
+      const Node &n=m_nodes[m_table[i]];
+      if(n.level==level && std::equal(child, child+4, n.child))
+        return m_table[i];
+      i=(i+1)&mask;
+    }
+
+    uint32_t id;
+    if(!m_free.empty()){
+      id=m_free.back();
+      m_free.pop_back();
+    }else{
+      id=m_nodes.size();
+      m_nodes.push_back(Node());
+    }
+    Node &n=m_nodes[id];
+    std::copy(child, child+4, n.child);
+    n.level=level;
+    m_table[i]=id;
+    m_live++;
+
+    if(2*m_live > m_table.size()){
+      rebuildTable(2*m_table.size());
+    }
+    return id;
+  }
+
+  uint32_t leaf(uint64_t cells)
+  { return make(LeafLevel, uint32_t(cells), uint32_t(cells>>32), 0, 0); }
+
+  uint64_t leafCells(uint32_t id) const
+  { return uint64_t(m_nodes[id].child[0]) | uint64_t(m_nodes[id].child[1])<<32; }
+
+  uint32_t join(uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se)
+  { return make(m_nodes[nw].level+1, nw, ne, sw, se); }
+
+  uint32_t child(uint32_t id, unsigned i) const
+  { return m_nodes[id].child[i]; }
+
+  //! Centre half of a node, with no time passing
+  uint32_t centre(uint32_t id)
+  {
+    if(m_nodes[id].level==LeafLevel+1){
+      uint64_t cells=0;
+      for(unsigned r=0; r<8; r++){
+        uint64_t west=leafCells(child(id, r<4 ? 0 : 2)), east=leafCells(child(id, r<4 ? 1 : 3));
+        unsigned src=(r+4)%8;
+        cells|=((west>>(8*src+4))&0x0F)<<(8*r);
+        cells|=((east>>(8*src))&0x0F)<<(8*r+4);
+      }
+      return leaf(cells);
+    }
+    return join(child(child(id,0),3), child(child(id,1),2), child(child(id,2),1), child(child(id,3),0));
+  }
+
+  //! Mark everything reachable from m_roots, sweep the rest
+  void collect()
+  {
+    std::vector<uint8_t> marked(m_nodes.size(), 0);
+    std::vector<uint32_t> stack(m_roots);
+    while(!stack.empty()){
+      uint32_t id=stack.back();
+      stack.pop_back();
+      if(marked[id])
+        continue;
+      marked[id]=1;
+      if(m_nodes[id].level>LeafLevel){
+        for(unsigned i=0; i<4; i++){
+          stack.push_back(m_nodes[id].child[i]);
+        }
+      }
+    }
+
+    m_free.clear();
+    m_live=0;
+    for(uint32_t id=0; id<m_nodes.size(); id++){
+      if(marked[id]){
+        m_live++;
+      }else{
+        m_nodes[id].level=Free;
+        m_free.push_back(id);
+      }
+    }
+    // Lowest ids are reused first, which keeps the live set compact
+    std::reverse(m_free.begin(), m_free.end());
+
+    rebuildTable(m_table.size());
+
+    std::vector<Memo> old;
+    old.swap(m_memo);
+    m_memo.assign(old.size(), Memo{None,0,None});
+    m_memoUsed=0;
+    for(const Memo &e : old){
+      if(e.key!=None && marked[e.key] && marked[e.value])
+        memoInsert(e.key, e.step, e.value);
+    }
+
+    m_collections++;
+    // Don't thrash if most of the store is genuinely live
+    m_gcThreshold=std::max(m_maxNodes, 2*m_live);
+  }
+
+  //! 2^j generations of the centre 8x8 of a 16x16 node, by brute force
+  uint32_t baseSuccessor(uint32_t id, unsigned j)
+  {
+    uint64_t q[4];
+    for(unsigned i=0; i<4; i++){
+      q[i]=leafCells(child(id,i));
+    }
+    uint32_t rows[16];
+    for(unsigned r=0; r<8; r++){
+      rows[r]=uint32_t((q[0]>>(8*r))&0xFF) | uint32_t((q[1]>>(8*r))&0xFF)<<8;
+      rows[r+8]=uint32_t((q[2]>>(8*r))&0xFF) | uint32_t((q[3]>>(8*r))&0xFF)<<8;
+    }
+    // Cells outside the 16x16 are taken as dead; the error creeps in one
+    // cell per generation, so the centre is exact for up to 4.
+    for(unsigned s=0; s<(1u<<j); s++){
+      uint32_t next[16];
+      for(unsigned y=0; y<16; y++){
+        uint32_t a=y>0 ? rows[y-1] : 0, c=rows[y], b=y<15 ? rows[y+1] : 0;
+        next[y]=LifeBitboardRule<uint32_t>(a<<1, a, a>>1, c<<1, c, c>>1, b<<1, b, b>>1) & 0xFFFF;
+      }
+      std::copy(next, next+16, rows);
+    }
+    uint64_t cells=0;
+    for(unsigned r=0; r<8; r++){
+      cells|=uint64_t((rows[r+4]>>4)&0xFF)<<(8*r);
+    }
+    return leaf(cells);
+  }
+
+  //! Centre half of node, 2^j generations on; j <= level-2
+  uint32_t successor(uint32_t id, unsigned j)
+  {
+    size_t rootBase=m_roots.size();
+    m_roots.push_back(id);
+    if(m_live > m_gcThreshold)
+      collect();
+
+    uint32_t res=memoFind(id, j);
+    if(res!=None){
+      m_memoHits++;
+      m_roots.resize(rootBase);
+      return res;
+    }
+    m_memoMisses++;
+
+    unsigned level=m_nodes[id].level;
+    if(level==LeafLevel+1){
+      res=baseSuccessor(id, j);
+    }else{
+      uint32_t a=child(id,0), b=child(id,1), c=child(id,2), d=child(id,3);
+      uint32_t sub[9]={
+        a, join(child(a,1), child(b,0), child(a,3), child(b,2)), b,
+        join(child(a,2), child(a,3), child(c,0), child(c,1)),
+        join(child(a,3), child(b,2), child(c,1), child(d,0)),
+        join(child(b,2), child(b,3), child(d,0), child(d,1)),
+        c, join(child(c,1), child(d,0), child(c,3), child(d,2)), d
+      };
+      m_roots.insert(m_roots.end(), sub, sub+9);
+
+      // Full speed takes two half steps; slower just recentres first
+      bool full=(j==level-2);
+      uint32_t mid[9];
+      for(unsigned i=0; i<9; i++){
+        mid[i]=full ? successor(sub[i], level-3) : centre(sub[i]);
+        m_roots.push_back(mid[i]);
+      }
+
+      uint32_t quad[4];
+      static const unsigned corner[4]={0, 1, 3, 4};
+      for(unsigned i=0; i<4; i++){
+        unsigned k=corner[i];
+        uint32_t node=join(mid[k], mid[k+1], mid[k+3], mid[k+4]);
+        quad[i]=successor(node, full ? level-3 : j);
+        m_roots.push_back(quad[i]);
+      }
+      res=join(quad[0], quad[1], quad[2], quad[3]);
+    }
+
+    memoInsert(id, j, res);
+    m_roots.resize(rootBase);
+    return res;
+  }
+
+  //! The board tiled periodically, with cell (0,0) at (offset,offset)
+  uint32_t build(const LifeBitboard &board, unsigned level, uint64_t x0, uint64_t y0, unsigned offset)
+  {
+    if(level==LeafLevel){
+      unsigned n=board.n();
+      uint64_t cells=0;
+      for(unsigned r=0; r<8; r++){
+        const uint64_t *row=board.row((y0+r+n-offset%n)%n);
+        unsigned x=(x0+n-offset%n)%n;
+        for(unsigned c=0; c<8; c++){
+          cells|=uint64_t((row[x/64]>>(x%64))&1)<<(8*r+c);
+          x = x+1==n ? 0 : x+1;
+        }
+      }
+      return leaf(cells);
+    }
+    uint64_t half=uint64_t(1)<<(level-1);
+    uint32_t nw=build(board, level-1, x0, y0, offset);
+    uint32_t ne=build(board, level-1, x0+half, y0, offset);
+    uint32_t sw=build(board, level-1, x0, y0+half, offset);
+    uint32_t se=build(board, level-1, x0+half, y0+half, offset);
+    return join(nw, ne, sw, se);
+  }
+
+  //! Write the cells of node, whose corner is at (x0,y0), that land on the board
+  void extract(uint32_t id, uint64_t x0, uint64_t y0, LifeBitboard &board) const
+  {
+    unsigned n=board.n();
+    if(x0>=n || y0>=n)
+      return;
+    unsigned level=m_nodes[id].level;
+    if(level==LeafLevel){
+      uint64_t cells=leafCells(id);
+      for(unsigned r=0; r<8 && y0+r<n; r++){
+        uint64_t *row=board.row(y0+r);
+        for(unsigned c=0; c<8 && x0+c<n; c++){
+          unsigned x=x0+c;
+          uint64_t bit=uint64_t(1)<<(x%64);
+          row[x/64]=((cells>>(8*r+c))&1) ? (row[x/64]|bit) : (row[x/64]&~bit);
+        }
+      }
+      return;
+    }
+    uint64_t half=uint64_t(1)<<(level-1);
+    extract(child(id,0), x0, y0, board);
+    extract(child(id,1), x0+half, y0, board);
+    extract(child(id,2), x0, y0+half, board);
+    extract(child(id,3), x0+half, y0+half, board);
+  }
+
+public:
+  LifeHashlife(unsigned maxNodes=1u<<22)
+    : m_live(0)
+    , m_table(1024, None)
+    , m_memoUsed(0)
+    , m_maxNodes(maxNodes)
+    , m_gcThreshold(maxNodes)
+    , m_collections(0)
+    , m_memoHits(0)
+    , m_memoMisses(0)
+  {}
+
+  //! Universe level used for a board of side n
+  static unsigned UniverseLevel(unsigned n)
+  {
+    unsigned level=LeafLevel+1;
+    while((uint64_t(1)<<(level-1)) < n){
+      level++;
+    }
+    return level;
+  }
+
+  //! Largest jump Advance can take in one go for a board of side n
+  static uint64_t MaxJump(unsigned n)
+  { return uint64_t(1)<<(UniverseLevel(n)-2); }
+
+  //! Advance board by 2^j generations; 2^j must be at most MaxJump(n)
+  void Advance(LifeBitboard &board, unsigned j)
+  {
+    unsigned level=UniverseLevel(board.n());
+    uint64_t quarter=uint64_t(1)<<(level-2);
+
+    // Roots from any earlier call are finished with
+    m_roots.clear();
+    uint32_t universe=build(board, level, 0, 0, quarter%board.n());
+    uint32_t res=successor(universe, j);
+
+    extract(res, 0, 0, board);
+    for(unsigned y=0; y<board.n(); y++){
+      board.FixRow(y);
+    }
+  }
+
+  unsigned LiveNodes() const
+  { return m_live; }
+
+  uint64_t Collections() const
+  { return m_collections; }
+
+  double MemoHitRate() const
+  {
+    uint64_t total=m_memoHits+m_memoMisses;
+    return total ? double(m_memoHits)/total : 0.0;
+  }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef life_lookup_hpp
+#define life_lookup_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "life_bitboard.hpp"
+
+/*! Life by table lookup, four cells at a time.
+
+  A 3x6 block of cells (six columns of the rows above, at and below)
+  is packed into an 18 bit index, and the table holds the next state of
+  the four middle cells of the centre row. A word of 64 cells is then
+  sixteen lookups, using nothing wider than plain integer shifts, so it
+  suits hosts where the full-adder kernel gets no help from SIMD. The
+  256KB table is built once and shared.
+
+  Has the same StepWords interface as LifeBitwiseKernel, so it can be
+  handed to any of the bitboard engines. Each rule gets its own table.
+*/
+template<class TRule=LifeConwayRule>
+class LifeLookupKernel
+{
+public:
+  typedef TRule Rule;
+
+private:
+  const uint8_t *m_next;
+
+  static std::vector<uint8_t> build()
+  {
+    std::vector<uint8_t> next(1u<<18);
+    for(unsigned index=0; index<next.size(); index++){
+      unsigned result=0;
+      for(unsigned j=0; j<4; j++){
+        // Cell j+1 of the centre row, with rows at bits 0, 6 and 12
+        unsigned count=0;
+        for(unsigned r=0; r<3; r++){
+          for(unsigned x=j; x<j+3; x++){
+            count+=(index>>(6*r+x))&1;
+          }
+        }
+        bool alive=(index>>(6+j+1))&1;
+        count-=alive;
+        if(((alive ? TRule::Survive : TRule::Birth)>>count)&1){
+          result|=1u<<j;
+        }
+      }
+      next[index]=result;
+    }
+    return next;
+  }
+
+  //! Cells 4k-1 .. 4k+4 of word i of row p
+  static unsigned window(const uint64_t *p, unsigned i, unsigned k)
+  {
+    if(k==0){
+      return ((p[i]<<1)|((p-1)[i]>>63)) & 63;
+    }else if(k<15){
+      return (p[i]>>(4*k-1)) & 63;
+    }else{
+      return (p[i]>>59) | ((p[i+1]&1)<<5);
+    }
+  }
+
+public:
+  LifeLookupKernel()
+  {
+    static const std::vector<uint8_t> next=build();
+    m_next=&next[0];
+  }
+
+  template<bool TTrackChanges>
+  uint64_t StepWords(const uint64_t *a, const uint64_t *c, const uint64_t *b, uint64_t *d, unsigned begin, unsigned end) const
+  {
+    uint64_t changes=0;
+    for(unsigned i=begin; i<end; i++){
+      uint64_t res=0;
+      for(unsigned k=0; k<16; k++){
+        unsigned index=window(a, i, k) | (window(c, i, k)<<6) | (window(b, i, k)<<12);
+        res|=uint64_t(m_next[index])<<(4*k);
+      }
+      if(TTrackChanges){
+        changes|=res^d[i];
+      }
+      d[i]=res;
+    }
+    return changes;
+  }
+};
+
+#endif
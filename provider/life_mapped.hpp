@@ -0,0 +1,198 @@
+#ifndef life_mapped_hpp
+#define life_mapped_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "life_bitboard.hpp"
+
+/*! A Life board kept in a memory-mapped file, laid out like LifeBitboard.
+
+  Rows are the same guard, cells, guard words as in memory, so the
+  bitboard kernels run on it directly. Only the pages being worked on
+  need to be resident: Prefetch and Release pass hints to the kernel
+  for a range of rows, and released pages go back to the file (or are
+  simply dropped, if clean) rather than counting against the process.
+*/
+class LifeMappedBoard
+{
+private:
+  // No implementation for either
+  LifeMappedBoard(const LifeMappedBoard &); // = delete;
+  LifeMappedBoard &operator=(const LifeMappedBoard &); // = delete;
+
+  unsigned m_n;
+  unsigned m_words;
+  unsigned m_stride;
+  size_t m_bytes;
+  int m_fd;
+  uint64_t *m_cells;
+
+  void advise(unsigned yBegin, unsigned yEnd, int advice) const
+  {
+    if(yBegin>=yEnd)
+      return;
+    size_t page=sysconf(_SC_PAGESIZE);
+    size_t begin=uint64_t(yBegin)*m_stride*8, end=uint64_t(yEnd)*m_stride*8;
+    begin-=begin%page;
+    madvise((char*)m_cells+begin, end-begin, advice);
+  }
+
+public:
+  /*! Map a board of n x n cells in a new file, private to this user.
+
+    With temporary, path is a directory: the file gets a unique name
+    there from mkstemp and is unlinked as soon as it is open, so it
+    goes away with the board (or the process). Otherwise the file is
+    created at path, which must not already exist (not even as a
+    symlink), so a shared directory such as /tmp can't be used to
+    redirect the writes elsewhere.
+  */
+  LifeMappedBoard(const std::string &path, unsigned n, bool temporary)
+    : m_n(n)
+    , m_words((n+63)/64)
+    , m_stride(m_words+2)
+    , m_bytes(uint64_t(n)*m_stride*8)
+    , m_fd(-1)
+    , m_cells(0)
+  {
+    if(temporary){
+      std::string name=path+"/life_board_XXXXXX";
+      m_fd=mkstemp(&name[0]);
+      if(m_fd==-1)
+        throw std::runtime_error("LifeMappedBoard::LifeMappedBoard - couldn't create a board in '"+path+"'.");
+      unlink(name.c_str());
+    }else{
+      m_fd=open(path.c_str(), O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW, 0600);
+      if(m_fd==-1)
+        throw std::runtime_error("LifeMappedBoard::LifeMappedBoard - couldn't create '"+path+"'.");
+    }
+    if(ftruncate(m_fd, m_bytes)!=0){
+      close(m_fd);
+      throw std::runtime_error("LifeMappedBoard::LifeMappedBoard - couldn't size '"+path+"'.");
+    }
+    void *cells=mmap(0, m_bytes, PROT_READ|PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if(cells==MAP_FAILED){
+      close(m_fd);
+      throw std::runtime_error("LifeMappedBoard::LifeMappedBoard - couldn't map '"+path+"'.");
+    }
+    m_cells=(uint64_t*)cells;
+  }
+
+  ~LifeMappedBoard()
+  {
+    munmap(m_cells, m_bytes);
+    close(m_fd);
+  }
+
+  unsigned n() const
+  { return m_n; }
+
+  unsigned words() const
+  { return m_words; }
+
+  uint64_t *row(unsigned y)
+  { return m_cells+uint64_t(y)*m_stride+1; }
+
+  const uint64_t *row(unsigned y) const
+  { return m_cells+uint64_t(y)*m_stride+1; }
+
+  bool Get(unsigned x, unsigned y) const
+  { return (row(y)[x/64]>>(x%64))&1; }
+
+  void FixRow(unsigned y)
+  { LifeBitboard::FixRow(row(y), m_n); }
+
+  //! Rows [yBegin,yEnd) will be needed soon
+  void Prefetch(unsigned yBegin, unsigned yEnd) const
+  { advise(yBegin, std::min(yEnd, m_n), MADV_WILLNEED); }
+
+  //! Rows [yBegin,yEnd) will not be needed for a while
+  void Release(unsigned yBegin, unsigned yEnd) const
+  { advise(yBegin, std::min(yEnd, m_n), MADV_DONTNEED); }
+
+  //! Rows per megabyte, for releasing as Load and Store go
+  unsigned chunkRows() const
+  { return std::max(1u, unsigned((1u<<20)/(m_stride*8))); }
+
+  void Load(const std::vector<bool> &state)
+  {
+    if(state.size()!=uint64_t(m_n)*m_n)
+      throw std::runtime_error("LifeMappedBoard::Load - state size is inconsistent.");
+    unsigned chunk=chunkRows();
+    for(unsigned y=0; y<m_n; y++){
+      uint64_t *r=row(y);
+      std::fill(r, r+m_words, 0);
+      for(unsigned x=0; x<m_n; x++){
+        r[x/64] |= uint64_t(state[uint64_t(y)*m_n+x])<<(x%64);
+      }
+      FixRow(y);
+      if((y+1)%chunk==0){
+        Release(y+1-chunk, y+1);
+      }
+    }
+    Release(0, m_n);
+  }
+
+  void Store(std::vector<bool> &state) const
+  {
+    state.resize(uint64_t(m_n)*m_n);
+    unsigned chunk=chunkRows();
+    for(unsigned y=0; y<m_n; y++){
+      const uint64_t *r=row(y);
+      for(unsigned x=0; x<m_n; x++){
+        state[uint64_t(y)*m_n+x]=(r[x/64]>>(x%64))&1;
+      }
+      if((y+1)%chunk==0){
+        Release(y+1-chunk, y+1);
+      }
+    }
+  }
+};
+
+/*! Compute dst as the generation after src, one stripe of rows at a time.
+
+  Row y of dst reads rows y-1, y and y+1 of src, so while a stripe is
+  computed only it, the halo rows either side, and the same stripe of
+  dst are touched. The next stripe of src is prefetched, and source
+  rows behind the window and the finished stripe of dst are released,
+  so resident memory stays around a few stripes whatever the board
+  size. The only other rows read are row n-1 (for row 0) and row 0 (for
+  row n-1), which wrap round the torus.
+
+  parallelFor(count, f) must call f(begin,end) over ranges covering
+  [0,count), where the indices are rows within the stripe.
+*/
+template<class TParallelFor, class TKernel=LifeBitwiseKernel<> >
+void LifeMappedStep(const LifeMappedBoard &src, LifeMappedBoard &dst, unsigned stripeRows, TParallelFor parallelFor, const TKernel &kernel=TKernel())
+{
+  unsigned n=src.n(), words=src.words();
+  stripeRows=std::max(1u, stripeRows);
+  for(unsigned y0=0; y0<n; y0+=stripeRows){
+    unsigned y1=std::min(n, y0+stripeRows);
+    src.Prefetch(y1, y1+stripeRows+1);
+
+    parallelFor(y1-y0, [&](unsigned begin, unsigned end){
+        for(unsigned y=y0+begin; y<y0+end; y++){
+          const uint64_t *a=src.row(y==0 ? n-1 : y-1);
+          const uint64_t *b=src.row(y+1==n ? 0 : y+1);
+          kernel.template StepWords<false>(a, src.row(y), b, dst.row(y), 0, words);
+          dst.FixRow(y);
+        }
+      });
+
+    // Row y1-1 is still the halo of the next stripe
+    src.Release(y0==0 ? 1 : y0-1, y1-1);
+    dst.Release(y0, y1);
+  }
+}
+
+#endif
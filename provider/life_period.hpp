@@ -0,0 +1,125 @@
+#ifndef life_period_hpp
+#define life_period_hpp
+
+#include <cstdint>
+
+#include "life_bitboard.hpp"
+
+/*! Notices when a whole Life board starts repeating itself.
+
+  Boards are hashed at most once every interval generations and each
+  hash is checked against that of an anchor board, with a full compare
+  to confirm a match. The anchor moves to the latest board whenever the
+  gap since it reaches the current window, which doubles each time
+  (Brent's cycle finding), so one stored board is enough to catch any
+  period once the window has grown past it.
+
+  Only sampled generations are compared, so the period found is the gap
+  between two of them: a multiple of the true period, which is just as
+  good for skipping ahead. Hashing is one pass over the words, so with
+  the default interval it costs a small fraction of a step.
+*/
+class LifePeriodDetector
+{
+private:
+  unsigned m_interval;
+  LifeBitboard m_anchor;
+  uint64_t m_anchorHash;
+  uint64_t m_anchorGeneration;
+  uint64_t m_lastSample;
+  uint64_t m_window;
+  bool m_hasAnchor;
+
+  uint64_t m_samples;
+  uint64_t m_compares;
+
+  static bool equal(const LifeBitboard &a, const LifeBitboard &b)
+  {
+    for(unsigned y=0; y<a.rows(); y++){
+      const uint64_t *ra=a.row(y), *rb=b.row(y);
+      for(unsigned i=0; i<a.words(); i++){
+        if(ra[i]!=rb[i])
+          return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  //! interval==0 disables detection
+  LifePeriodDetector(unsigned n, unsigned interval)
+    : m_interval(interval)
+    , m_anchor(n, 0)
+    , m_anchorHash(0)
+    , m_anchorGeneration(0)
+    , m_lastSample(0)
+    , m_window(interval)
+    , m_hasAnchor(false)
+    , m_samples(0)
+    , m_compares(0)
+  {}
+
+  //! 64-bit hash of the cells, in four independent lanes so it streams
+  static uint64_t Hash(const LifeBitboard &board)
+  {
+    const uint64_t M=0x9E3779B97F4A7C15ull;
+    uint64_t h[4]={1, 2, 3, 4};
+    for(unsigned y=0; y<board.rows(); y++){
+      const uint64_t *r=board.row(y);
+      unsigned i=0;
+      for(; i+4<=board.words(); i+=4){
+        for(unsigned j=0; j<4; j++){
+          h[j]=(h[j]^r[i+j])*M;
+        }
+      }
+      for(; i<board.words(); i++){
+        h[0]=(h[0]^r[i])*M;
+      }
+    }
+    uint64_t acc=h[0];
+    for(unsigned j=1; j<4; j++){
+      acc=(acc^(acc>>29)^h[j])*M;
+    }
+    return acc^(acc>>32);
+  }
+
+  /*! Look at the board as it is at the given generation.
+
+    Generations must increase from call to call. Returns 0, or a number
+    of generations after which the board is known to repeat exactly.
+  */
+  uint64_t Observe(const LifeBitboard &board, uint64_t generation)
+  {
+    if(m_interval==0 || (m_hasAnchor && generation-m_lastSample<m_interval))
+      return 0;
+    m_lastSample=generation;
+    m_samples++;
+
+    uint64_t hash=Hash(board);
+    if(m_hasAnchor && hash==m_anchorHash){
+      m_compares++;
+      if(equal(board, m_anchor))
+        return generation-m_anchorGeneration;
+    }
+
+    if(!m_hasAnchor || generation-m_anchorGeneration>=m_window){
+      if(m_hasAnchor){
+        m_window*=2;
+      }
+      m_anchor=board;
+      m_anchorHash=hash;
+      m_anchorGeneration=generation;
+      m_hasAnchor=true;
+    }
+    return 0;
+  }
+
+  uint64_t Samples() const
+  { return m_samples; }
+
+  //! Full compares made because hashes matched
+  uint64_t Compares() const
+  { return m_compares; }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef life_temporal_hpp
+#define life_temporal_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "life_bitboard.hpp"
+
+/*! Advances a Life board several generations per pass over memory.
+
+  The board is cut into bands of bandRows full-width rows. Each band is
+  stepped depth times with depth extra rows either side, in a private
+  pair of strips that stay in cache (losing one halo row each side per
+  generation), and only the band itself is written back. One
+  pass therefore reads and writes the board once for depth generations,
+  at the cost of recomputing 2*depth halo rows per band.
+
+  Bands only read the source board and write disjoint rows of the
+  destination, so they can be handed out to threads freely. Each of
+  the workers has its own pair of strips, allocated once up front.
+*/
+class LifeTemporalBlocking
+{
+private:
+  unsigned m_bandRows;
+  unsigned m_depth;
+  std::vector<LifeBitboard> m_strips;  // Two per worker
+
+public:
+  //! For an n x n board, with StepBands called from up to workers threads at once
+  LifeTemporalBlocking(unsigned n, unsigned bandRows, unsigned depth, unsigned workers)
+    : m_bandRows(std::max(1u, bandRows))
+    , m_depth(std::max(1u, depth))
+    , m_strips(2*std::max(1u, workers), LifeBitboard(n, m_bandRows+2*m_depth))
+  {}
+
+  unsigned workers() const
+  { return m_strips.size()/2; }
+
+  unsigned depth() const
+  { return m_depth; }
+
+  unsigned bandCount(unsigned n) const
+  { return (n+m_bandRows-1)/m_bandRows; }
+
+  /*! Write bands [begin,end) of dst as src advanced by depth generations.
+
+    depth may be less than the configured depth, for the last pass.
+    Concurrent calls must pass different workers.
+  */
+  template<class TKernel=LifeBitwiseKernel<> >
+  void StepBands(const LifeBitboard &src, LifeBitboard &dst, unsigned depth, unsigned begin, unsigned end, unsigned worker, const TKernel &kernel=TKernel())
+  {
+    unsigned n=src.n(), words=src.words();
+    LifeBitboard *a=&m_strips[2*worker], *b=&m_strips[2*worker+1];
+
+    for(unsigned band=begin; band<end; band++){
+      unsigned y0=band*m_bandRows, y1=std::min(n, y0+m_bandRows);
+      unsigned rows=(y1-y0)+2*depth;
+
+      // Strip row r is board row y0-depth+r, wrapping round the torus.
+      // After generation g, strip rows [g,rows-g) are exact; the first
+      // generation reads straight from the board.
+      for(unsigned g=1; g<=depth; g++){
+        bool last=(g==depth);
+        for(unsigned r=g; r<rows-g; r++){
+          const uint64_t *above, *curr, *below;
+          if(g==1){
+            unsigned y=(y0+r+uint64_t(n)*depth-depth)%n;
+            above=src.row(y==0 ? n-1 : y-1);
+            curr=src.row(y);
+            below=src.row(y+1==n ? 0 : y+1);
+          }else{
+            above=a->row(r-1);
+            curr=a->row(r);
+            below=a->row(r+1);
+          }
+          uint64_t *d=last ? dst.row(y0+r-depth) : b->row(r);
+          kernel.template StepWords<false>(above, curr, below, d, 0, words);
+          if(last){
+            dst.FixRow(y0+r-depth);
+          }else{
+            b->FixRow(r);
+          }
+        }
+        std::swap(a, b);
+      }
+    }
+  }
+};
+
+#endif
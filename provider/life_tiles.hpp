@@ -0,0 +1,165 @@
+#ifndef life_tiles_hpp
+#define life_tiles_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "life_bitboard.hpp"
+
+/*! Skips the parts of a Life board that are repeating themselves.
+
+  The board is split into tiles of tileRows rows by tileWords words.
+  With double buffering the destination holds generation g-1 while g+1
+  is computed from g, so if the neighbourhood of a tile (it and its
+  eight neighbours, wrapping round the torus) is the same at g as at
+  g-2, the tile at g+1 equals the tile at g-1 and is already in place.
+  Each tile keeps a flag saying whether it differs from two generations
+  back, found by comparing against the old destination contents as they
+  are overwritten, and tiles with no flagged neighbours are skipped.
+
+  That covers still lifes and also blinkers and the other period-2
+  oscillators which litter a settled random board. Steps where the
+  destination does not hold the previous generation (the first, or
+  after the board was modified elsewhere) must pass all=true.
+
+  Young random boards are active nearly everywhere, where the tracking
+  is pure overhead, so after a step with more than DenseFraction of
+  tiles active the next DenseSteps steps just process whole rows.
+*/
+class LifeActiveTiles
+{
+private:
+  unsigned m_n;
+  unsigned m_words;
+  unsigned m_tileRows, m_tileWords;
+  unsigned m_tilesY, m_tilesX;
+  uint64_t m_lastMask;  // Valid cells in the last word of a row
+
+  std::vector<uint8_t> m_changed, m_nextChanged;
+  std::vector<unsigned> m_activeInRow;  // Tiles processed in each row of tiles, this step
+
+  uint64_t m_steps;
+  uint64_t m_active;
+  unsigned m_lastActive;
+  unsigned m_denseRemaining;
+  bool m_allFlagged;  // Every tile is flagged, so the next step says nothing
+
+  static constexpr double DenseFraction=0.5;
+  enum{ DenseSteps=31 };
+
+  bool neighbourhoodChanged(unsigned ty, unsigned tx) const
+  {
+    for(int dy=-1; dy<=1; dy++){
+      unsigned y=(ty+m_tilesY+dy)%m_tilesY;
+      for(int dx=-1; dx<=1; dx++){
+        unsigned x=(tx+m_tilesX+dx)%m_tilesX;
+        if(m_changed[y*m_tilesX+x])
+          return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  LifeActiveTiles(unsigned n, unsigned tileRows, unsigned tileWords)
+    : m_n(n)
+    , m_words((n+63)/64)
+    , m_tileRows(std::max(1u, tileRows))
+    , m_tileWords(std::max(1u, tileWords))
+    , m_tilesY((n+m_tileRows-1)/m_tileRows)
+    , m_tilesX((m_words+m_tileWords-1)/m_tileWords)
+    , m_lastMask(n%64 ? (uint64_t(1)<<(n%64))-1 : ~uint64_t(0))
+    , m_changed(m_tilesY*m_tilesX, 1)
+    , m_nextChanged(m_tilesY*m_tilesX, 1)
+    , m_activeInRow(m_tilesY, 0)
+    , m_steps(0)
+    , m_active(0)
+    , m_lastActive(0)
+    , m_denseRemaining(0)
+    , m_allFlagged(true)
+  {}
+
+  unsigned tileCount() const
+  { return m_tilesY*m_tilesX; }
+
+  /*! Compute dst as the generation after src.
+
+    parallelFor(count, f) must call f(begin,end) over ranges covering
+    [0,count), where the indices are rows of tiles.
+  */
+  template<class TParallelFor, class TKernel=LifeBitwiseKernel<> >
+  void Step(const LifeBitboard &src, LifeBitboard &dst, bool all, TParallelFor parallelFor, const TKernel &kernel=TKernel())
+  {
+    m_steps++;
+    if(m_denseRemaining>0){
+      m_denseRemaining--;
+      parallelFor(m_tilesY, [&](unsigned begin, unsigned end){
+          LifeBitboardStepRows(src, dst, begin*m_tileRows, std::min(m_n, end*m_tileRows), kernel);
+        });
+      // Nothing is known about what changed, so the next step does everything
+      std::fill(m_changed.begin(), m_changed.end(), 1);
+      m_allFlagged=true;
+      m_lastActive=tileCount();
+      m_active+=m_lastActive;
+      return;
+    }
+
+    std::fill(m_activeInRow.begin(), m_activeInRow.end(), 0);
+    parallelFor(m_tilesY, [&](unsigned begin, unsigned end){
+        for(unsigned ty=begin; ty<end; ty++){
+          unsigned y0=ty*m_tileRows, y1=std::min(m_n, y0+m_tileRows);
+          for(unsigned tx=0; tx<m_tilesX; tx++){
+            unsigned t=ty*m_tilesX+tx;
+            if(!all && !neighbourhoodChanged(ty, tx)){
+              m_nextChanged[t]=0;
+              continue;
+            }
+            m_activeInRow[ty]++;
+
+            unsigned w0=tx*m_tileWords, w1=std::min(m_words, w0+m_tileWords);
+            uint64_t diff=0;
+            for(unsigned y=y0; y<y1; y++){
+              const uint64_t *a=src.row(y==0 ? m_n-1 : y-1);
+              const uint64_t *c=src.row(y);
+              const uint64_t *b=src.row(y+1==m_n ? 0 : y+1);
+              uint64_t *d=dst.row(y);
+              if(w1<m_words){
+                diff|=kernel.template StepWords<true>(a, c, b, d, w0, w1);
+              }else{
+                // Padding bits past the last cell hold junk until FixRow
+                diff|=kernel.template StepWords<true>(a, c, b, d, w0, w1-1);
+                diff|=kernel.template StepWords<true>(a, c, b, d, w1-1, w1) & m_lastMask;
+              }
+            }
+            // The old contents mean nothing on a full step
+            m_nextChanged[t]=all || diff!=0;
+          }
+          for(unsigned y=y0; y<y1; y++){
+            dst.FixRow(y);
+          }
+        }
+      });
+    m_changed.swap(m_nextChanged);
+
+    m_lastActive=0;
+    for(unsigned a : m_activeInRow){
+      m_lastActive+=a;
+    }
+    m_active+=m_lastActive;
+    if(!all && !m_allFlagged && m_lastActive > DenseFraction*tileCount()){
+      m_denseRemaining=DenseSteps;
+    }
+    m_allFlagged=all;
+  }
+
+  //! Fraction of tiles processed in the last step
+  double LastActiveFraction() const
+  { return double(m_lastActive)/tileCount(); }
+
+  //! Fraction of tiles processed, averaged over every step so far
+  double ActiveFraction() const
+  { return m_steps ? double(m_active)/(double(m_steps)*tileCount()) : 0.0; }
+};
+
+#endif
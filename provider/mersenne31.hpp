@@ -0,0 +1,249 @@
+#ifndef mersenne31_hpp
+#define mersenne31_hpp
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*! Arithmetic mod the Mersenne prime 2^31-1, without dividing.
+
+  Since 2^31 = 1 mod p, x = (x&p)+(x>>31) mod p, and that fold takes
+  any 64-bit x below 2^33+2^31 (and products of reduced values, which
+  are below 2^62, below 2^32), so sums of folded terms can run for
+  billions of terms in 64 bits before one final Reduce.
+
+  Step and WrapDot reproduce MatrixExponentPuzzle's Step and its chains
+  of Mul and Add bit for bit, including the 32-bit wrap of a*b before
+  the modulo; MulMod is the true modular product.
+*/
+struct Mersenne31
+{
+  static const uint32_t P=2147483647u;
+
+  //! Same residue as x, below 2^33+2^31, or below 2^32 if x<2^62
+  static uint64_t Fold(uint64_t x)
+  { return (x&P)+(x>>31); }
+
+  //! x mod p, for any x
+  static uint32_t Reduce(uint64_t x)
+  {
+    x=Fold(Fold(x));
+    return uint32_t(x>=P ? x-P : x);
+  }
+
+  static uint32_t MulMod(uint32_t a, uint32_t b)
+  { return Reduce(uint64_t(a)*b); }
+
+  //! MatrixExponentPuzzle::Step
+  static uint32_t Step(uint32_t x)
+  { return Reduce(15807ULL*x); }
+
+  /*! The fold of Add(sum, Mul(a[i], b[i])) over [0,n) from sum=0.
+
+    Mul's results are below p, so none of those Adds wrap and the
+    chain is just the sum of the wrapped products mod p, which can be
+    accumulated lazily, in any order.
+  */
+  static uint32_t WrapDot(const uint32_t *a, const uint32_t *b, unsigned n);
+};
+
+/*! Four 64-bit lanes of Mersenne31 arithmetic.
+
+  Uses one AVX2 register, two SSE2 registers, or plain words, whichever
+  the build allows. Held by value and loaded with unaligned loads, as
+  for CircuitSimWide.
+*/
+struct Mersenne31Lanes
+{
+#if defined(__AVX2__)
+  __m256i v;
+#elif defined(__SSE2__)
+  __m128i lo, hi;
+#else
+  uint64_t w[4];
+#endif
+
+  static Mersenne31Lanes Zero()
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_setzero_si256();
+#elif defined(__SSE2__)
+    r.lo=r.hi=_mm_setzero_si128();
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=0;
+    }
+#endif
+    return r;
+  }
+
+  //! p[0..3], each widened to a lane
+  static Mersenne31Lanes Load(const uint32_t *p)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)p));
+#elif defined(__SSE2__)
+    __m128i x=_mm_loadu_si128((const __m128i*)p), z=_mm_setzero_si128();
+    r.lo=_mm_unpacklo_epi32(x, z);
+    r.hi=_mm_unpackhi_epi32(x, z);
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=p[i];
+    }
+#endif
+    return r;
+  }
+
+  //! x in every lane
+  static Mersenne31Lanes Broadcast(uint32_t x)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_set1_epi64x(x);
+#elif defined(__SSE2__)
+    r.lo=r.hi=_mm_set1_epi64x(x);
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=x;
+    }
+#endif
+    return r;
+  }
+
+  //! p[0..3] as they are
+  static Mersenne31Lanes Load64(const uint64_t *p)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_loadu_si256((const __m256i*)p);
+#elif defined(__SSE2__)
+    r.lo=_mm_loadu_si128((const __m128i*)p);
+    r.hi=_mm_loadu_si128((const __m128i*)(p+2));
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=p[i];
+    }
+#endif
+    return r;
+  }
+
+  void Store(uint64_t *p) const
+  {
+#if defined(__AVX2__)
+    _mm256_storeu_si256((__m256i*)p, v);
+#elif defined(__SSE2__)
+    _mm_storeu_si128((__m128i*)p, lo);
+    _mm_storeu_si128((__m128i*)(p+2), hi);
+#else
+    for(unsigned i=0; i<4; i++){
+      p[i]=w[i];
+    }
+#endif
+  }
+
+  friend Mersenne31Lanes operator+(const Mersenne31Lanes &a, const Mersenne31Lanes &b)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_add_epi64(a.v, b.v);
+#elif defined(__SSE2__)
+    r.lo=_mm_add_epi64(a.lo, b.lo);
+    r.hi=_mm_add_epi64(a.hi, b.hi);
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=a.w[i]+b.w[i];
+    }
+#endif
+    return r;
+  }
+
+  //! Full 64-bit products of lanes holding 32-bit values
+  static Mersenne31Lanes MulWide(const Mersenne31Lanes &a, const Mersenne31Lanes &b)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_mul_epu32(a.v, b.v);
+#elif defined(__SSE2__)
+    r.lo=_mm_mul_epu32(a.lo, b.lo);
+    r.hi=_mm_mul_epu32(a.hi, b.hi);
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=a.w[i]*b.w[i];
+    }
+#endif
+    return r;
+  }
+
+  //! Products of lanes holding 32-bit values, wrapped to 32 bits
+  static Mersenne31Lanes MulWrap(const Mersenne31Lanes &a, const Mersenne31Lanes &b)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    r.v=_mm256_and_si256(_mm256_mul_epu32(a.v, b.v), _mm256_set1_epi64x(0xFFFFFFFFull));
+#elif defined(__SSE2__)
+    __m128i mask=_mm_set_epi32(0, -1, 0, -1);
+    r.lo=_mm_and_si128(_mm_mul_epu32(a.lo, b.lo), mask);
+    r.hi=_mm_and_si128(_mm_mul_epu32(a.hi, b.hi), mask);
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=uint32_t(a.w[i]*b.w[i]);
+    }
+#endif
+    return r;
+  }
+
+  //! Mersenne31::Fold of each lane
+  static Mersenne31Lanes Fold(const Mersenne31Lanes &a)
+  {
+    Mersenne31Lanes r;
+#if defined(__AVX2__)
+    __m256i p=_mm256_set1_epi64x(Mersenne31::P);
+    r.v=_mm256_add_epi64(_mm256_and_si256(a.v, p), _mm256_srli_epi64(a.v, 31));
+#elif defined(__SSE2__)
+    __m128i p=_mm_set_epi32(0, Mersenne31::P, 0, Mersenne31::P);
+    r.lo=_mm_add_epi64(_mm_and_si128(a.lo, p), _mm_srli_epi64(a.lo, 31));
+    r.hi=_mm_add_epi64(_mm_and_si128(a.hi, p), _mm_srli_epi64(a.hi, 31));
+#else
+    for(unsigned i=0; i<4; i++){
+      r.w[i]=Mersenne31::Fold(a.w[i]);
+    }
+#endif
+    return r;
+  }
+
+  //! Sum of the lanes mod p
+  uint32_t Reduce() const
+  {
+    uint64_t w4[4];
+    Store(w4);
+    uint64_t sum=0;
+    for(unsigned i=0; i<4; i++){
+      sum+=Mersenne31::Reduce(w4[i]);
+    }
+    return Mersenne31::Reduce(sum);
+  }
+};
+
+inline uint32_t Mersenne31::WrapDot(const uint32_t *a, const uint32_t *b, unsigned n)
+{
+  // Wrapped products are below 2^32, so lanes hold 2^32 of them
+  Mersenne31Lanes acc0=Mersenne31Lanes::Zero(), acc1=acc0;
+  unsigned i=0;
+  for(; i+8<=n; i+=8){
+    acc0=acc0+Mersenne31Lanes::MulWrap(Mersenne31Lanes::Load(a+i), Mersenne31Lanes::Load(b+i));
+    acc1=acc1+Mersenne31Lanes::MulWrap(Mersenne31Lanes::Load(a+i+4), Mersenne31Lanes::Load(b+i+4));
+  }
+  uint64_t tail=0;
+  for(; i<n; i++){
+    tail+=uint32_t(a[i]*b[i]);
+  }
+  return Reduce(uint64_t((acc0+acc1).Reduce())+Reduce(tail));
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef mod_gemm_hpp
+#define mod_gemm_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "mersenne31.hpp"
+#include "thread_pool.hpp"
+
+/*! Matrix multiplication over the integers mod 2^31-1.
+
+  Computes C=A*B with A m x k, B k x n and C m x n, all row-major, with
+  exact modular arithmetic (unlike the wrapping Mul and Add of
+  MatrixExponentPuzzle). Entries may be any uint32_t; they are reduced
+  while being packed.
+
+  A is packed with its rows padded to a multiple of four, and B is
+  transposed into panels of four columns, interleaved so that one load
+  picks up one row of B across the panel. C is cut into blockRows x
+  blockCols output blocks, which are the tasks handed to the pool, and
+  the depth is cut into blockDepth slices so the A and B panels for a
+  block stay in L2 while a 4x4 micro-kernel streams them through four
+  Mersenne31Lanes sums.
+
+  Products of reduced entries are below 2^62, so four of them can be
+  added before they are folded (to below 2^34), and the 64-bit sums can
+  take any k before the final reduction.
+*/
+class ModGemm
+{
+public:
+  static const uint32_t Modulus=Mersenne31::P;
+
+private:
+  unsigned m_blockRows;
+  unsigned m_blockCols;
+  unsigned m_blockDepth;
+
+  enum{ Micro=4 };
+
+  /*! acc[r*stride+c] += a row r . panel column c over [begin,end)
+
+    a points at four rows of k entries, panel at k groups of four.
+  */
+  static void microKernel(const uint32_t *a, const uint32_t *panel, unsigned k, unsigned begin, unsigned end, uint64_t *acc, unsigned stride)
+  {
+    const uint32_t *a0=a, *a1=a+k, *a2=a+2*k, *a3=a+3*k;
+    Mersenne31Lanes s0=Mersenne31Lanes::Zero(), s1=s0, s2=s0, s3=s0;
+    // Four products of reduced values sum to below 2^64, so are folded together
+#define MOD_GEMM_TERMS(ar, i) Mersenne31Lanes::Fold(Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(ar[i]), y0) \
+							+Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(ar[i+1]), y1) \
+							+Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(ar[i+2]), y2) \
+							+Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(ar[i+3]), y3))
+    unsigned i=begin;
+    for(; i+4<=end; i+=4){
+      Mersenne31Lanes y0=Mersenne31Lanes::Load(panel+Micro*i), y1=Mersenne31Lanes::Load(panel+Micro*(i+1));
+      Mersenne31Lanes y2=Mersenne31Lanes::Load(panel+Micro*(i+2)), y3=Mersenne31Lanes::Load(panel+Micro*(i+3));
+      s0=s0+MOD_GEMM_TERMS(a0, i);
+      s1=s1+MOD_GEMM_TERMS(a1, i);
+      s2=s2+MOD_GEMM_TERMS(a2, i);
+      s3=s3+MOD_GEMM_TERMS(a3, i);
+    }
+#undef MOD_GEMM_TERMS
+    for(; i<end; i++){
+      Mersenne31Lanes y=Mersenne31Lanes::Load(panel+Micro*i);
+      s0=s0+Mersenne31Lanes::Fold(Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(a0[i]), y));
+      s1=s1+Mersenne31Lanes::Fold(Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(a1[i]), y));
+      s2=s2+Mersenne31Lanes::Fold(Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(a2[i]), y));
+      s3=s3+Mersenne31Lanes::Fold(Mersenne31Lanes::MulWide(Mersenne31Lanes::Broadcast(a3[i]), y));
+    }
+    (Mersenne31Lanes::Load64(acc)+s0).Store(acc);
+    (Mersenne31Lanes::Load64(acc+stride)+s1).Store(acc+stride);
+    (Mersenne31Lanes::Load64(acc+2*stride)+s2).Store(acc+2*stride);
+    (Mersenne31Lanes::Load64(acc+3*stride)+s3).Store(acc+3*stride);
+  }
+
+  //! One output block: rows [r0,r1) and columns [c0,c1) of C, with r0 and c0 multiples of four
+  void block(unsigned n, unsigned k, const uint32_t *a, const uint32_t *panels, uint32_t *c, unsigned r0, unsigned r1, unsigned c0, unsigned c1) const
+  {
+    // Padded out to whole tiles; the padding is zero and is not stored
+    unsigned rows=(r1-r0+Micro-1)/Micro*Micro, cols=(c1-c0+Micro-1)/Micro*Micro;
+    std::vector<uint64_t> acc(uint64_t(rows)*cols, 0);
+    for(unsigned k0=0; k0<k; k0+=m_blockDepth){
+      unsigned k1=std::min(k, k0+m_blockDepth);
+      for(unsigned r=0; r<rows; r+=Micro){
+	const uint32_t *ar=a+uint64_t(r0+r)*k;
+	for(unsigned j=0; j<cols; j+=Micro){
+	  microKernel(ar, panels+uint64_t(c0+j)*k, k, k0, k1, &acc[r*cols+j], cols);
+	}
+      }
+    }
+    for(unsigned r=0; r<r1-r0; r++){
+      for(unsigned j=0; j<c1-c0; j++){
+	c[uint64_t(r0+r)*n+c0+j]=Mersenne31::Reduce(acc[r*cols+j]);
+      }
+    }
+  }
+
+public:
+  /*! Block sizes are in entries, and are rounded up to multiples of
+    four; the defaults keep a 64-row panel of A and a 64-column panel
+    of B, each 512 deep, within a 256KB L2.
+  */
+  ModGemm(unsigned blockRows=64, unsigned blockCols=64, unsigned blockDepth=512)
+    : m_blockRows((std::max(1u, blockRows)+Micro-1)/Micro*Micro)
+    , m_blockCols((std::max(1u, blockCols)+Micro-1)/Micro*Micro)
+    , m_blockDepth(std::max(1u, blockDepth))
+  {}
+
+  /*! Reduce the k x n matrix b into panels of four columns.
+
+    Column c of b, row i, goes to entry (c/4)*4*k + 4*i + c%4; columns
+    past n are zero.
+  */
+  static std::vector<uint32_t> PackPanels(unsigned k, unsigned n, const uint32_t *b)
+  {
+    unsigned width=(n+Micro-1)/Micro*Micro;
+    std::vector<uint32_t> res(uint64_t(width)*k, 0);
+    for(unsigned i=0; i<k; i++){
+      for(unsigned c=0; c<n; c++){
+	res[uint64_t(c/Micro)*Micro*k+Micro*i+c%Micro]=Mersenne31::Reduce(b[uint64_t(i)*n+c]);
+      }
+    }
+    return res;
+  }
+
+  //! c = a*b mod 2^31-1, with c m x n, a m x k and b k x n, splitting blocks of c across pool
+  void Multiply(ThreadPool &pool, unsigned m, unsigned n, unsigned k, const uint32_t *a, const uint32_t *b, uint32_t *c) const
+  {
+    if(k==0){
+      std::fill(c, c+uint64_t(m)*n, 0);
+      return;
+    }
+    if(m==0 || n==0)
+      return;
+    std::vector<uint32_t> pa(uint64_t((m+Micro-1)/Micro*Micro)*k, 0);
+    for(uint64_t i=0; i<uint64_t(m)*k; i++){
+      pa[i]=Mersenne31::Reduce(a[i]);
+    }
+    std::vector<uint32_t> panels=PackPanels(k, n, b);
+
+    unsigned blocksDown=(m+m_blockRows-1)/m_blockRows;
+    unsigned blocksAcross=(n+m_blockCols-1)/m_blockCols;
+    pool.Run(blocksDown*blocksAcross, [&](unsigned task){
+	unsigned r0=(task/blocksAcross)*m_blockRows, c0=(task%blocksAcross)*m_blockCols;
+	block(n, k, &pa[0], &panels[0], c, r0, std::min(m, r0+m_blockRows), c0, std::min(n, c0+m_blockCols));
+      });
+  }
+
+  std::vector<uint32_t> Multiply(ThreadPool &pool, unsigned m, unsigned n, unsigned k, const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) const
+  {
+    if(a.size()!=uint64_t(m)*k || b.size()!=uint64_t(k)*n)
+      throw std::runtime_error("ModGemm::Multiply - matrix sizes are inconsistent.");
+    std::vector<uint32_t> c(uint64_t(m)*n);
+    if(!c.empty()){
+      Multiply(pool, m, n, k, a.data(), b.data(), &c[0]);
+    }
+    return c;
+  }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! A fixed set of worker threads for fork-join loops.
+
+  Run() hands out task indices to the workers and the calling thread,
+  and only returns once every worker has finished, so consecutive calls
+  are separated by a barrier. Workers spin briefly before sleeping, as
+  the typical caller issues many short Run()s back to back (one per
+  circuit level, or per Life generation).
+*/
+class ThreadPool
+{
+private:
+  // No implementation for either
+  ThreadPool(const ThreadPool &); // = delete;
+  ThreadPool &operator=(const ThreadPool &); // = delete;
+
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+
+  std::atomic<uint64_t> m_generation;
+  std::atomic<unsigned> m_nextTask;
+  std::atomic<unsigned> m_busy;
+  bool m_quit;
+
+  const std::function<void(unsigned)> *m_task;
+  unsigned m_taskCount;
+
+  void work()
+  {
+    unsigned task;
+    while((task=m_nextTask.fetch_add(1)) < m_taskCount){
+      (*m_task)(task);
+    }
+  }
+
+  void workerLoop()
+  {
+    uint64_t seen=0;
+    while(true){
+      uint64_t gen;
+      unsigned spins=0;
+      while((gen=m_generation.load())==seen && spins<(1u<<14)){
+        spins++;
+      }
+      if(gen==seen){
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [&](){ return m_quit || m_generation.load()!=seen; });
+        if(m_quit)
+          return;
+        gen=m_generation.load();
+      }
+      seen=gen;
+      work();
+      m_busy.fetch_sub(1);
+    }
+  }
+
+public:
+  //! threads==0 means one per hardware thread; the caller counts as one
+  ThreadPool(unsigned threads=0)
+    : m_generation(0)
+    , m_nextTask(0)
+    , m_busy(0)
+    , m_quit(false)
+    , m_task(0)
+    , m_taskCount(0)
+  {
+    if(threads==0)
+      threads=std::max(1u, std::thread::hardware_concurrency());
+    for(unsigned i=1; i<threads; i++){
+      m_workers.push_back(std::thread([this](){ workerLoop(); }));
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_quit=true;
+    }
+    m_wake.notify_all();
+    for(auto &w : m_workers){
+      w.join();
+    }
+  }
+
+  //! Number of threads taking part in Run, including the caller
+  unsigned size() const
+  { return m_workers.size()+1; }
+
+  //! Call f(i) for i in [0,taskCount), returning once all calls are done
+  void Run(unsigned taskCount, const std::function<void(unsigned)> &f)
+  {
+    if(m_workers.empty() || taskCount<=1){
+      for(unsigned i=0; i<taskCount; i++){
+        f(i);
+      }
+      return;
+    }
+
+    m_task=&f;
+    m_taskCount=taskCount;
+    m_nextTask.store(0);
+    m_busy.store(m_workers.size());
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_generation.fetch_add(1);
+    }
+    m_wake.notify_all();
+
+    work();
+    while(m_busy.load()!=0){
+      std::this_thread::yield();
+    }
+  }
+
+  //! Split [0,n) into contiguous chunks of at least grain items
+  void ParallelFor(unsigned n, unsigned grain, const std::function<void(unsigned,unsigned)> &f)
+  {
+    unsigned chunks=std::min(4*size(), std::max(1u, n/std::max(1u,grain)));
+    Run(chunks, [&](unsigned i){
+        f(uint64_t(n)*i/chunks, uint64_t(n)*(i+1)/chunks);
+      });
+  }
+};
+
+#endif
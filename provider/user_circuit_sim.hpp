@@ -3,12 +3,238 @@
 
 #include "puzzler/puzzles/circuit_sim.hpp"
 
+#include "circuit_sim_compiled.hpp"
+#include "circuit_sim_optimiser.hpp"
+#include "circuit_sim_batch.hpp"
+#include "circuit_sim_parallel.hpp"
+#include "circuit_sim_cycles.hpp"
+#include "circuit_sim_codegen.hpp"
+#include "circuit_sim_events.hpp"
+#include "circuit_sim_trace.hpp"
+#include "circuit_sim_whatif.hpp"
+#include "env_options.hpp"
+
+//! Engine settings, defaulting to the PUZZLER_CIRCUIT_* environment variables
+struct CircuitSimOptions
+{
+  //! Worker threads for level-parallel evaluation; 0 is one per core, 1 is serial
+  unsigned threads;
+  //! Levels with fewer gates than this are evaluated serially
+  unsigned parallelLevelWidth;
+  //! Maximum states remembered while looking for limit cycles, capped
+  //! at the run's cycle count; 0 disables
+  unsigned cycleTableEntries;
+  //! Netlists with at least this many slots hold values one bit per slot
+  unsigned packedMinSlots;
+  //! Event-driven evaluation is used in cycles where at most this
+  //! fraction of flip-flops toggled; 0 disables it
+  double eventMaxToggleFraction;
+  //! Use the native code backend when gates*cycles reaches this; 0 disables
+  double codegenMinWork;
+  //! Compiler for the native backend, with any flags, separated by spaces (no shell)
+  std::string codegenCompiler;
+  //! Cache for the native backend, which must be private to this user;
+  //! empty is CircuitSimNative::DefaultCacheDir()
+  std::string codegenCacheDir;
+  //! Most bytes ExecutePerturbed keeps of the baseline run before it
+  //! re-simulates it in segments instead (see CircuitSimWhatIf)
+  uint64_t whatIfBaselineBytes;
+  //! If set, Execute writes a binary waveform trace here
+  std::string tracePath;
+  //! If set as well as tracePath, the trace is also converted to VCD here
+  std::string traceVcdPath;
+
+  CircuitSimOptions()
+    : threads(EnvOption("PUZZLER_CIRCUIT_THREADS", 0u))
+    , parallelLevelWidth(EnvOption("PUZZLER_CIRCUIT_PARALLEL_WIDTH", 8192u))
+    , cycleTableEntries(EnvOption("PUZZLER_CIRCUIT_CYCLE_TABLE", 1u<<18))
+    , packedMinSlots(EnvOption("PUZZLER_CIRCUIT_PACKED_SLOTS", 1u<<24))
+    , eventMaxToggleFraction(EnvOption("PUZZLER_CIRCUIT_EVENT_TOGGLES", 0.02))
+    , codegenMinWork(EnvOption("PUZZLER_CIRCUIT_CODEGEN_MIN_WORK", 0.0))
+    , codegenCompiler(EnvOption("PUZZLER_CIRCUIT_CODEGEN_CXX", std::string("c++")))
+    , codegenCacheDir(EnvOption("PUZZLER_CIRCUIT_CODEGEN_DIR", std::string()))
+    , whatIfBaselineBytes(EnvOption("PUZZLER_CIRCUIT_WHATIF_BYTES", uint64_t(1)<<28))
+    , tracePath(EnvOption("PUZZLER_CIRCUIT_TRACE", std::string()))
+    , traceVcdPath(EnvOption("PUZZLER_CIRCUIT_TRACE_VCD", std::string()))
+  {}
+};
+
 
 class CircuitSimProvider
   : public puzzler::CircuitSimPuzzle
 {
+private:
+  CircuitSimOptions m_options;
+
+  CircuitSimCompiled Compile(
+			     puzzler::ILog *log,
+			     const puzzler::CircuitSimInput *input
+			     ) const
+  {
+    log->LogVerbose("Optimising netlist");
+    CircuitSimOptimised optimised(input);
+    log->LogVerbose("Removed %u of %u gates (%u folded, %u merged, %u dead)",
+		    optimised.removedCount(), input->nandGateCount,
+		    optimised.foldedCount(), optimised.mergedCount(), optimised.deadCount());
+
+    log->LogVerbose("Compiling netlist");
+    CircuitSimCompiled netlist(optimised.flipFlopCount(), optimised.nandGateInputs(), optimised.flipFlopInputs());
+    log->LogVerbose("Compiled %u gates into %u levels", netlist.gateCount(), netlist.levelCount());
+    return netlist;
+  }
+
+  /*! Run input->clockCycles cycles using step(values,scratch).
+
+    TLayout says how values are held (see circuit_sim_compiled.hpp), so
+    this serves the bit-packed interpreter and the 64-bit native code.
+  */
+  template<class TLayout, class TStep>
+  void RunCycles(
+		 puzzler::ILog *log,
+		 const puzzler::CircuitSimInput *input,
+		 const CircuitSimCompiled &netlist,
+		 TStep step,
+		 puzzler::CircuitSimOutput *output
+		 ) const
+  {
+    typedef typename TLayout::word_t word_t;
+
+    unsigned flipFlopCount=netlist.flipFlopCount();
+    unsigned stateWords=TLayout::StateWords(netlist);
+    std::vector<word_t> values(TLayout::Words(netlist), word_t(0));
+    std::vector<word_t> scratch(stateWords);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      TLayout::Set(values.data(), i, input->inputState[i]);
+    }
+    log->LogVerbose("Working set is %llu bytes", (unsigned long long)(values.size()*sizeof(word_t)
+								     +2*netlist.gateCount()*sizeof(uint32_t)));
+
+    // Traces must cover every cycle, so they turn off fast-forwarding
+    std::unique_ptr<CircuitSimTraceWriter> trace;
+    std::vector<word_t> previous;
+    if(!m_options.tracePath.empty()){
+      log->LogVerbose("Tracing to %s", m_options.tracePath.c_str());
+      trace.reset(new CircuitSimTraceWriter(m_options.tracePath, input->inputState));
+    }
+
+    // Limit cycle detection: a fingerprint hit at cycle i is confirmed by
+    // checking the state comes back again after the same period. A run
+    // records at most one state per cycle, so short runs get small tables.
+    unsigned tableEntries=std::min<unsigned>(m_options.cycleTableEntries, input->clockCycles);
+    CircuitSimCycleDetector detector(trace ? 0 : tableEntries);
+    std::vector<word_t> candidate;
+    uint32_t candidateCycle=0, candidatePeriod=0;
+
+    log->LogVerbose("About to start running clock cycles (total = %d", input->clockCycles);
+    unsigned i=0;
+    while(i<input->clockCycles){
+      if(detector.Enabled() && candidatePeriod==0){
+        uint32_t previous;
+        uint64_t fingerprint=CircuitSimCycleDetector::Fingerprint(values.data(), stateWords*sizeof(word_t));
+        if(detector.Observe(fingerprint, i, previous)){
+          candidate.assign(values.begin(), values.begin()+stateWords);
+          candidateCycle=i;
+          candidatePeriod=i-previous;
+        }
+      }else if(candidatePeriod!=0 && i==candidateCycle+candidatePeriod){
+        if(std::equal(candidate.begin(), candidate.end(), values.begin())){
+          unsigned skip=(input->clockCycles-i)/candidatePeriod*candidatePeriod;
+          log->LogVerbose("State at cycle %u repeats with period %u, skipping %u cycles", candidateCycle, candidatePeriod, skip);
+          i+=skip;
+          detector=CircuitSimCycleDetector(0);
+          if(i==input->clockCycles)
+            break;
+        }
+        candidatePeriod=0;
+      }
+
+      log->LogVerbose("Starting iteration %d of %d\n", i, input->clockCycles);
+
+      if(trace){
+	previous.assign(values.begin(), values.begin()+stateWords);
+      }
+
+      step(values.data(), scratch.data());
+      i++;
+
+      if(trace){
+	trace->BeginCycle(i);
+	TLayout::ForEachDiff(previous.data(), values.data(), stateWords, [&](unsigned f){
+	    trace->Toggle(f);
+	  });
+	trace->EndCycle();
+      }
+
+      log->Log(puzzler::Log_Debug,[&](std::ostream &dst) {
+	  for(unsigned i=0; i<flipFlopCount; i++){
+	    dst<<TLayout::Get(values.data(), i);
+	  }
+	});
+    }
+    log->LogVerbose("Finished clock cycles");
+
+    if(trace){
+      trace.reset();
+      if(!m_options.traceVcdPath.empty()){
+	log->LogVerbose("Converting trace to %s", m_options.traceVcdPath.c_str());
+	CircuitSimTraceToVcd(m_options.tracePath, m_options.traceVcdPath);
+      }
+    }
+
+    output->outputState.resize(flipFlopCount);
+    for(unsigned i=0; i<flipFlopCount; i++){
+      output->outputState[i]=TLayout::Get(values.data(), i);
+    }
+  }
+
+  //! Interpreted simulation: event-driven, serial or level-parallel
+  template<class TLayout>
+  void RunInterpreter(
+		      puzzler::ILog *log,
+		      const puzzler::CircuitSimInput *input,
+		      const CircuitSimCompiled &netlist,
+		      puzzler::CircuitSimOutput *output
+		      ) const
+  {
+    typedef typename TLayout::word_t word_t;
+
+    // Only worth starting threads if some level is wide enough to split
+    unsigned widest=0;
+    for(unsigned l=0; l<netlist.levelCount(); l++){
+      widest=std::max(widest, netlist.levelBegin()[l+1]-netlist.levelBegin()[l]);
+    }
+    unsigned threads=widest>=m_options.parallelLevelWidth ? m_options.threads : 1;
+    ThreadPool pool(threads);
+    log->LogVerbose("Using %u threads (widest level has %u gates)", pool.size(), widest);
+
+    auto evaluateAll=[&](word_t *values){
+      if(pool.size()>1){
+	CircuitSimParallelEvaluate<TLayout>(netlist, pool, m_options.parallelLevelWidth, values);
+      }else{
+	TLayout::EvaluateRange(netlist, values, 0, netlist.gateCount());
+      }
+    };
+
+    CircuitSimEventDriven<TLayout> events(netlist, m_options.eventMaxToggleFraction);
+    RunCycles<TLayout>(log, input, netlist, [&](word_t *values, word_t *scratch){
+	if(m_options.eventMaxToggleFraction>0){
+	  events.Step(values, scratch, evaluateAll);
+	}else{
+	  evaluateAll(values);
+	  TLayout::Latch(netlist, values, scratch);
+	  std::copy(scratch, scratch+TLayout::StateWords(netlist), values);
+	}
+      }, output);
+
+    if(m_options.eventMaxToggleFraction>0){
+      log->LogVerbose("Event-driven activity factor %.4f, %llu of %llu cycles fully evaluated",
+		      events.ActivityFactor(), (unsigned long long)events.FullCycles(), (unsigned long long)events.Cycles());
+    }
+  }
+
 public:
-  CircuitSimProvider()
+  CircuitSimProvider(const CircuitSimOptions &options=CircuitSimOptions())
+    : m_options(options)
   {}
 
   virtual void Execute(
@@ -16,7 +242,105 @@ public:
 		       const puzzler::CircuitSimInput *input,
 		       puzzler::CircuitSimOutput *output
 		       ) const override {
-    ReferenceExecute(log, input, output);
+    CircuitSimCompiled netlist=Compile(log, input);
+
+    double work=double(netlist.gateCount())*input->clockCycles;
+    if(m_options.codegenMinWork>0 && work>=m_options.codegenMinWork){
+      log->LogVerbose("Building native code for netlist");
+      CircuitSimNative native(netlist, m_options.codegenCompiler, m_options.codegenCacheDir);
+      if(native.Available()){
+	RunCycles<CircuitSimSlotLayout<uint64_t> >(log, input, netlist, [&](uint64_t *values, uint64_t *scratch){
+	    native.Step(values, scratch);
+	  }, output);
+	return;
+      }
+      log->LogInfo("Native backend unavailable (%s), using interpreter", native.Error().c_str());
+    }
+
+    // Bit-packing costs a few extra operations per gate, which only pays
+    // off once the byte-per-gate values no longer fit in cache.
+    if(netlist.slotCount()>=m_options.packedMinSlots){
+      RunInterpreter<CircuitSimPackedLayout>(log, input, netlist, output);
+    }else{
+      RunInterpreter<CircuitSimSlotLayout<uint8_t> >(log, input, netlist, output);
+    }
+  }
+
+  /*! Run the same netlist from many initial states.
+
+    inputStates replaces input->inputState, and there is one output per
+    initial state. Instances are bit-sliced 256 (or 64 for the tail) to
+    a word, so cost scales with the number of words rather than the
+    number of instances.
+  */
+  void ExecuteBatch(
+		    puzzler::ILog *log,
+		    const puzzler::CircuitSimInput *input,
+		    const std::vector<std::vector<bool> > &inputStates,
+		    std::vector<std::shared_ptr<puzzler::CircuitSimOutput> > &outputs
+		    ) const
+  {
+    CircuitSimCompiled netlist=Compile(log, input);
+
+    unsigned count=inputStates.size();
+    outputs.resize(count);
+    std::vector<const std::vector<bool> *> srcs(count);
+    std::vector<std::vector<bool> *> dsts(count);
+    for(unsigned i=0; i<count; i++){
+      outputs[i]=std::make_shared<puzzler::CircuitSimOutput>(this, input);
+      srcs[i]=&inputStates[i];
+      dsts[i]=&outputs[i]->outputState;
+    }
+
+    unsigned done=0;
+    while(done<count){
+      unsigned todo=count-done;
+      log->LogVerbose("Batch simulating instances %u..%u of %u", done, done+std::min(todo,256u), count);
+      if(todo>64){
+        todo=std::min(todo, unsigned(CircuitSimLanes<CircuitSimWide>::Count));
+        CircuitSimRunBatch<CircuitSimWide>(netlist, input->clockCycles, &srcs[done], &dsts[done], todo);
+      }else{
+        CircuitSimRunBatch<uint64_t>(netlist, input->clockCycles, &srcs[done], &dsts[done], todo);
+      }
+      done+=todo;
+    }
+  }
+
+  /*! Simulate input with each set of initial flip-flops inverted.
+
+    Only the differences from input's own run are propagated, see
+    CircuitSimWhatIf; for repeated sweeps over one input, construct
+    that directly so the baseline is only recorded once.
+  */
+  void ExecutePerturbed(
+			puzzler::ILog *log,
+			const puzzler::CircuitSimInput *input,
+			const std::vector<std::vector<uint32_t> > &perturbations,
+			std::vector<std::shared_ptr<puzzler::CircuitSimOutput> > &outputs
+			) const
+  {
+    CircuitSimCompiled netlist=Compile(log, input);
+
+    log->LogVerbose("Recording baseline over %u cycles", input->clockCycles);
+    CircuitSimWhatIf whatIf(netlist, input->inputState, input->clockCycles, 0.25, m_options.whatIfBaselineBytes);
+    log->LogVerbose("Baseline takes %llu bytes, with a state kept every %u cycles",
+		    (unsigned long long)whatIf.BaselineBytes(), whatIf.BaselineInterval());
+
+    std::vector<std::vector<bool> > states;
+    std::vector<unsigned> converged;
+    whatIf.Run(perturbations, states, &converged);
+
+    unsigned rejoined=0;
+    outputs.resize(perturbations.size());
+    for(unsigned i=0; i<perturbations.size(); i++){
+      outputs[i]=std::make_shared<puzzler::CircuitSimOutput>(this, input);
+      outputs[i]->outputState.swap(states[i]);
+      rejoined += converged[i]<=input->clockCycles;
+    }
+    log->LogVerbose("%u of %u runs rejoined the baseline; %llu incremental and %llu full cycles, activity factor %.4f",
+		    rejoined, (unsigned)perturbations.size(),
+		    (unsigned long long)whatIf.IncrementalCycles(), (unsigned long long)whatIf.FullCycles(),
+		    whatIf.ActivityFactor());
   }
 
 };
@@ -1,14 +1,424 @@
 #ifndef user_life_hpp
 #define user_life_hpp
 
+#include <type_traits>
+
 #include "puzzler/puzzles/life.hpp"
 
+#include "life_bitboard.hpp"
+#include "life_checkpoint.hpp"
+#include "life_hashlife.hpp"
+#include "life_lookup.hpp"
+#include "life_mapped.hpp"
+#include "life_period.hpp"
+#include "life_temporal.hpp"
+#include "life_tiles.hpp"
+#include "thread_pool.hpp"
+#include "env_options.hpp"
+
+//! Engine settings, defaulting to the PUZZLER_LIFE_* environment variables
+struct LifeOptions
+{
+  //! Cell update used by the bitboard engines: "bitwise" (full adders
+  //! over 64 cells per word) or "lookup" (a table of 3x6 blocks)
+  std::string kernel;
+  //! Worker threads for row bands; 0 is one per core, 1 is serial
+  unsigned threads;
+  //! Boards with fewer cells than this are stepped serially
+  unsigned parallelMinCells;
+  //! Tiles of this many rows by words are skipped when nothing near
+  //! them changed; tileRows==0 steps every cell every generation
+  unsigned tileRows;
+  unsigned tileWords;
+  //! Hashlife takes over on boards of at least this many cells, with at
+  //! least hashlifeMinSteps generations left, once the fraction of words
+  //! that differ from two generations earlier drops to hashlifeMaxActivity
+  //! (checked every 64 generations); hashlifeMinCells==0 disables it.
+  //!
+  //! It is opt-in (PUZZLER_LIFE_HASHLIFE_CELLS=1 lets any board hand over)
+  //! because tile skipping and period skipping already make settled boards
+  //! cheap: on 2000x2000 soups the hand-over took 8.5s against 3.2s for
+  //! 100000 steps, and 29s against 2.7s for 400000. It can still win on
+  //! boards that keep growing non-periodic structure, such as guns.
+  unsigned hashlifeMinCells;
+  unsigned hashlifeMinSteps;
+  double hashlifeMaxActivity;
+  //! Node count at which the Hashlife store is garbage collected
+  unsigned hashlifeMaxNodes;
+  //! Boards of at least temporalMinBytes are stepped temporalDepth
+  //! generations per sweep, in bands of temporalRows rows, instead of
+  //! with tiles; temporalDepth<=1 disables it. It only pays once the
+  //! kernel is fast enough to be limited by memory (e.g. AVX2 builds),
+  //! and cannot skip settled regions the way tiles can.
+  unsigned temporalDepth;
+  unsigned temporalRows;
+  unsigned temporalMinBytes;
+  //! Whole-board hashes are compared every periodInterval generations,
+  //! to skip ahead once the board repeats; 0 disables it
+  unsigned periodInterval;
+  //! If set, the board is saved here every checkpointInterval
+  //! generations, and a run of the same input resumes from it
+  std::string checkpointPath;
+  unsigned checkpointInterval;
+  //! Boards of at least mappedMinBytes are kept in files under mappedDir
+  //! and stepped in stripes of mappedRows rows, so only a few stripes
+  //! need to be in memory; mappedMinBytes==0 disables it
+  unsigned mappedMinBytes;
+  std::string mappedDir;
+  unsigned mappedRows;
+
+  LifeOptions()
+    : kernel(EnvOption("PUZZLER_LIFE_KERNEL", std::string("bitwise")))
+    , threads(EnvOption("PUZZLER_LIFE_THREADS", 0u))
+    , parallelMinCells(EnvOption("PUZZLER_LIFE_PARALLEL_CELLS", 1u<<18))
+    , tileRows(EnvOption("PUZZLER_LIFE_TILE_ROWS", 32u))
+    , tileWords(EnvOption("PUZZLER_LIFE_TILE_WORDS", 8u))
+    , hashlifeMinCells(EnvOption("PUZZLER_LIFE_HASHLIFE_CELLS", 0u))
+    , hashlifeMinSteps(EnvOption("PUZZLER_LIFE_HASHLIFE_STEPS", 1024u))
+    , hashlifeMaxActivity(EnvOption("PUZZLER_LIFE_HASHLIFE_ACTIVITY", 0.001))
+    , hashlifeMaxNodes(EnvOption("PUZZLER_LIFE_HASHLIFE_NODES", 1u<<22))
+    , temporalDepth(EnvOption("PUZZLER_LIFE_TEMPORAL_DEPTH", 1u))
+    , temporalRows(EnvOption("PUZZLER_LIFE_TEMPORAL_ROWS", 256u))
+    , temporalMinBytes(EnvOption("PUZZLER_LIFE_TEMPORAL_BYTES", 16u<<20))
+    , periodInterval(EnvOption("PUZZLER_LIFE_PERIOD_INTERVAL", 8u))
+    , checkpointPath(EnvOption("PUZZLER_LIFE_CHECKPOINT", std::string()))
+    , checkpointInterval(EnvOption("PUZZLER_LIFE_CHECKPOINT_INTERVAL", 4096u))
+    , mappedMinBytes(EnvOption("PUZZLER_LIFE_MAPPED_BYTES", 0u))
+    , mappedDir(EnvOption("PUZZLER_LIFE_MAPPED_DIR", std::string("/tmp")))
+    , mappedRows(EnvOption("PUZZLER_LIFE_MAPPED_ROWS", 256u))
+  {}
+};
 
 class LifeProvider
   : public puzzler::LifePuzzle
 {
+private:
+  LifeOptions m_options;
+
+  //! Render the board (a LifeBitboard or LifeMappedBoard) at Log_Debug, if the generation is one to be drawn
+  template<class TBoard>
+  void draw(puzzler::ILog *log, const TBoard &board, unsigned generation) const
+  {
+    if(!m_render.Due(generation))
+      return;
+    log->Log(puzzler::Log_Debug, [&](std::ostream &dst){
+	render(dst, board.n(), generation, [&](unsigned x, unsigned y){
+	    return board.Get(x,y);
+	  });
+      });
+  }
+
+  static double activity(const LifeBitboard &a, const LifeBitboard &b)
+  {
+    uint64_t diff=0;
+    for(unsigned y=0; y<a.n(); y++){
+      const uint64_t *ra=a.row(y), *rb=b.row(y);
+      for(unsigned i=0; i<a.words(); i++){
+	diff += ra[i]!=rb[i];
+      }
+    }
+    return double(diff)/(double(a.n())*a.words());
+  }
+
+  /*! Generations that can be skipped now that curr is at generation done.
+
+    Once the board is known to repeat, whole periods are skipped and
+    detection stops, as fewer than a period of generations remain.
+  */
+  unsigned skipPeriods(puzzler::ILog *log, LifePeriodDetector &detector, bool &detecting, const LifeBitboard &curr, unsigned done, unsigned steps) const
+  {
+    if(!detecting)
+      return 0;
+    uint64_t period=detector.Observe(curr, done);
+    if(period==0)
+      return 0;
+    detecting=false;
+    unsigned skip=(steps-done)/period*period;
+    log->LogVerbose("Generation %u repeats every %llu generations, skipping %u", done, (unsigned long long)period, skip);
+    return skip;
+  }
+
+  /*! One generation at a time, in row bands across the pool.
+
+    Returns the number of generations run, which is fewer than steps if
+    the board has settled enough to hand over to Hashlife.
+  */
+  template<class TKernel>
+  unsigned runBands(puzzler::ILog *log, LifeBitboard &curr, unsigned steps, bool allowHashlife, const TKernel &kernel, LifeCheckpointWriter &checkpoints) const
+  {
+    unsigned n=curr.n();
+    LifeBitboard next(n);
+    std::unique_ptr<LifeBitboard> probe;
+
+    // Each band reads the rows either side of it from the previous
+    // generation, which stays untouched until every band is done.
+    unsigned threads=uint64_t(n)*n>=m_options.parallelMinCells ? m_options.threads : 1;
+    ThreadPool pool(threads);
+    log->LogVerbose("Using %u threads", pool.size());
+
+    LifeActiveTiles tiles(n, m_options.tileRows, m_options.tileWords);
+    auto step=[&](const LifeBitboard &src, LifeBitboard &dst, bool all){
+      if(m_options.tileRows>0){
+	tiles.Step(src, dst, all, [&](unsigned count, const std::function<void(unsigned,unsigned)> &f){
+	    pool.ParallelFor(count, 1, f);
+	  }, kernel);
+      }else{
+	pool.ParallelFor(n, 8, [&](unsigned begin, unsigned end){
+	    LifeBitboardStepRows(src, dst, begin, end, kernel);
+	  });
+      }
+    };
+
+    LifePeriodDetector detector(n, m_options.periodInterval);
+    bool detecting=true;
+
+    for(unsigned i=0; i<steps; i++){
+      log->LogVerbose("Starting iteration %d of %d\n", i, steps);
+
+      // Still lifes and period-2 oscillators, which is most of a settled
+      // board, look the same as two generations back
+      if(allowHashlife && i%64==1 && steps-i>=m_options.hashlifeMinSteps){
+	if(!probe)
+	  probe.reset(new LifeBitboard(n));
+	// Rotate so next still holds the generation before curr
+	step(curr, *probe, true);
+	double changed=activity(*probe, next);
+	log->LogVerbose("Generation %u has period-2 activity %.5f", i+1, changed);
+	std::swap(next, *probe);
+	std::swap(curr, next);
+	if(changed<=m_options.hashlifeMaxActivity){
+	  log->LogVerbose("Board has settled, handing over to Hashlife");
+	  log->LogVerbose("Processed %.4f of tiles on average", tiles.ActiveFraction());
+	  return i+1;
+	}
+      }else{
+	step(curr, next, i==0);
+	std::swap(curr, next);
+      }
+
+      if(m_options.tileRows>0 && i%64==0){
+	log->LogVerbose("Generation %u processed %.4f of tiles", i+1, tiles.LastActiveFraction());
+      }
+
+      // Whole periods on, curr and next are where they are now, so the
+      // tiles' record of what changed still holds
+      i+=skipPeriods(log, detector, detecting, curr, i+1, steps);
+      checkpoints.Observe(curr, i+1);
+
+      draw(log, curr, i+1);
+    }
+    if(m_options.tileRows>0){
+      log->LogVerbose("Processed %.4f of tiles on average", tiles.ActiveFraction());
+    }
+    return steps;
+  }
+
+  //! Several generations per sweep of the board, for boards that do not fit in cache
+  template<class TKernel>
+  void runTemporal(puzzler::ILog *log, LifeBitboard &curr, unsigned steps, const TKernel &kernel, LifeCheckpointWriter &checkpoints) const
+  {
+    unsigned n=curr.n();
+    LifeBitboard next(n);
+
+    unsigned threads=uint64_t(n)*n>=m_options.parallelMinCells ? m_options.threads : 1;
+    ThreadPool pool(threads);
+    log->LogVerbose("Using %u threads", pool.size());
+
+    LifeTemporalBlocking blocking(n, m_options.temporalRows, m_options.temporalDepth, pool.size());
+    unsigned bands=blocking.bandCount(n);
+    unsigned workers=std::min(blocking.workers(), bands);
+    log->LogVerbose("Stepping %u generations per sweep in %u bands", blocking.depth(), bands);
+
+    LifePeriodDetector detector(n, m_options.periodInterval);
+    bool detecting=true;
+
+    unsigned done=0;
+    while(done<steps){
+      unsigned depth=std::min(blocking.depth(), steps-done);
+      log->LogVerbose("Starting iteration %u of %u", done, steps);
+      // Bands cost the same, so each worker takes an equal run of them
+      pool.Run(workers, [&](unsigned w){
+	  blocking.StepBands(curr, next, depth, uint64_t(bands)*w/workers, uint64_t(bands)*(w+1)/workers, w, kernel);
+	});
+      std::swap(curr, next);
+      done+=depth;
+      done+=skipPeriods(log, detector, detecting, curr, done, steps);
+      checkpoints.Observe(curr, done);
+
+      draw(log, curr, done);
+    }
+  }
+
+  template<class TKernel>
+  unsigned run(puzzler::ILog *log, LifeBitboard &curr, unsigned steps, bool allowHashlife, bool temporal, const TKernel &kernel, LifeCheckpointWriter &checkpoints) const
+  {
+    if(temporal){
+      runTemporal(log, curr, steps, kernel, checkpoints);
+      return steps;
+    }
+    return runBands(log, curr, steps, allowHashlife, kernel, checkpoints);
+  }
+
+  /*! Straight from the input to the output through two mapped files.
+
+    Nothing but the stripes in flight is held in memory besides the
+    input and output themselves; period detection, checkpoints and
+    Hashlife all want whole boards in memory, so are not used.
+  */
+  template<class TKernel>
+  void runMapped(puzzler::ILog *log, const puzzler::LifeInput *input, puzzler::LifeOutput *output, const TKernel &kernel) const
+  {
+    unsigned n=input->n;
+    std::unique_ptr<LifeMappedBoard> curr(new LifeMappedBoard(m_options.mappedDir, n, true));
+    std::unique_ptr<LifeMappedBoard> next(new LifeMappedBoard(m_options.mappedDir, n, true));
+    log->LogVerbose("Mapped boards under %s, %u rows per stripe", m_options.mappedDir.c_str(), m_options.mappedRows);
+    curr->Load(input->state);
+    draw(log, *curr, 0);
+
+    unsigned threads=uint64_t(n)*n>=m_options.parallelMinCells ? m_options.threads : 1;
+    ThreadPool pool(threads);
+    log->LogVerbose("Using %u threads", pool.size());
+
+    for(unsigned i=0; i<input->steps; i++){
+      log->LogVerbose("Starting iteration %u of %u", i, input->steps);
+      LifeMappedStep(*curr, *next, m_options.mappedRows, [&](unsigned count, const std::function<void(unsigned,unsigned)> &f){
+	  pool.ParallelFor(count, 8, f);
+	}, kernel);
+      std::swap(curr, next);
+
+      draw(log, *curr, i+1);
+    }
+
+    log->LogVerbose("Finished steps");
+    curr->Store(output->state);
+  }
+
+  //! Power-of-two jumps with Hashlife; boards are only seen between jumps
+  void runHashlife(puzzler::ILog *log, LifeBitboard &curr, unsigned steps, LifeCheckpointWriter &checkpoints) const
+  {
+    LifeHashlife engine(m_options.hashlifeMaxNodes);
+    uint64_t maxJump=LifeHashlife::MaxJump(curr.n());
+
+    unsigned done=0;
+    while(done<steps){
+      unsigned j=0;
+      while((uint64_t(2)<<j)<=std::min<uint64_t>(maxJump, steps-done)){
+	j++;
+      }
+      log->LogVerbose("Jumping %u generations from %u of %u", 1u<<j, done, steps);
+      engine.Advance(curr, j);
+      done+=1u<<j;
+      checkpoints.Observe(curr, done);
+
+      draw(log, curr, done);
+    }
+
+    log->LogVerbose("Hashlife finished with %u live nodes, %llu collections, memo hit rate %.3f",
+		    engine.LiveNodes(), (unsigned long long)engine.Collections(), engine.MemoHitRate());
+  }
+
+  //! Birth and survival masks of a rule written "B3/S23", bit k for k neighbours
+  static void parseRule(const std::string &rule, unsigned &birth, unsigned &survive)
+  {
+    unsigned *mask=0;
+    birth=0;
+    survive=0;
+    for(char c : rule){
+      if(c=='B' || c=='b'){
+	mask=&birth;
+      }else if(c=='S' || c=='s'){
+	mask=&survive;
+      }else if(c>='0' && c<='8' && mask){
+	*mask|=1u<<(c-'0');
+      }else if(c!='/'){
+	throw std::runtime_error("LifeProvider::parseRule - '"+rule+"' is not of the form B3/S23.");
+      }
+    }
+  }
+
+  template<unsigned TBirth, unsigned TSurvive>
+  bool tryRule(unsigned birth, unsigned survive, puzzler::ILog *log, const puzzler::LifeInput *input, puzzler::LifeOutput *output) const
+  {
+    if(birth!=TBirth || survive!=TSurvive)
+      return false;
+    execute<LifeRule<TBirth,TSurvive> >(log, input, output);
+    return true;
+  }
+
+  template<class TRule>
+  void execute(puzzler::ILog *log, const puzzler::LifeInput *input, puzzler::LifeOutput *output) const
+  {
+    log->LogVerbose("About to start running iterations (total = %d)", input->steps);
+
+    bool lookup=m_options.kernel=="lookup";
+    if(!lookup && m_options.kernel!="bitwise")
+      throw std::runtime_error("LifeProvider::Execute - unknown kernel '"+m_options.kernel+"'.");
+    if(lookup){
+      log->LogVerbose("Using lookup table kernel");
+    }
+
+    unsigned n=input->n;
+    if(m_options.mappedMinBytes>0 && uint64_t(n)*((n+63)/64+2)*8>=m_options.mappedMinBytes){
+      if(lookup){
+	runMapped(log, input, output, LifeLookupKernel<TRule>());
+      }else{
+	runMapped(log, input, output, LifeBitwiseKernel<TRule>());
+      }
+      return;
+    }
+
+    LifeBitboard curr(n);
+    curr.Load(input->state);
+
+    draw(log, curr, 0);
+
+    // Checkpoints belong to one input under one rule
+    uint64_t inputHash=LifePeriodDetector::Hash(curr) ^ ((uint64_t(TRule::Birth)<<32) | TRule::Survive);
+    unsigned first=0;
+    if(!m_options.checkpointPath.empty()){
+      LifeCheckpoint checkpoint;
+      if(checkpoint.Load(m_options.checkpointPath)){
+	if(checkpoint.n()==n && checkpoint.steps()==input->steps && checkpoint.inputHash()==inputHash){
+	  checkpoint.Restore(curr);
+	  first=checkpoint.generation();
+	  log->LogInfo("Resuming from checkpoint at generation %u", first);
+	}else{
+	  log->LogInfo("Ignoring checkpoint '%s' from a different run", m_options.checkpointPath.c_str());
+	}
+      }
+    }
+    LifeCheckpointWriter checkpoints(m_options.checkpointPath, m_options.checkpointInterval, input->steps, inputHash, first);
+    unsigned steps=input->steps-first;
+
+    // The Hashlife leaves only know B3/S23
+    bool hashlife=std::is_same<TRule,LifeConwayRule>::value
+      && m_options.hashlifeMinCells>0
+      && uint64_t(n)*n>=m_options.hashlifeMinCells
+      && steps>=m_options.hashlifeMinSteps;
+    bool temporal=m_options.temporalDepth>1
+      && uint64_t(n)*curr.words()*8>=m_options.temporalMinBytes;
+    unsigned done=0;
+    if(lookup){
+      done=run(log, curr, steps, hashlife, temporal, LifeLookupKernel<TRule>(), checkpoints);
+    }else{
+      done=run(log, curr, steps, hashlife, temporal, LifeBitwiseKernel<TRule>(), checkpoints);
+    }
+    if(done<steps){
+      checkpoints.Rebase(first+done);
+      runHashlife(log, curr, steps-done, checkpoints);
+    }
+    if(checkpoints.Written()>0){
+      log->LogVerbose("Wrote %u checkpoints in %.3fs", checkpoints.Written(), checkpoints.Seconds());
+    }
+
+    log->LogVerbose("Finished steps");
+
+    curr.Store(output->state);
+  }
+
 public:
-  LifeProvider()
+  LifeProvider(const LifeOptions &options=LifeOptions())
+    : m_options(options)
   {}
 
   virtual void Execute(
@@ -16,7 +426,32 @@ public:
 		       const puzzler::LifeInput *input,
 		       puzzler::LifeOutput *output
 		       ) const override {
-    ReferenceExecute(log, input, output);
+    execute<LifeConwayRule>(log, input, output);
+  }
+
+  /*! Run input under another outer-totalistic rule, written "B36/S23".
+
+    Each rule is compiled into its own kernels, so only those listed
+    here can be used; Execute is the same as rule "B3/S23".
+  */
+  void ExecuteRule(
+		   puzzler::ILog *log,
+		   const puzzler::LifeInput *input,
+		   const std::string &rule,
+		   puzzler::LifeOutput *output
+		   ) const
+  {
+    unsigned birth, survive;
+    parseRule(rule, birth, survive);
+    bool found=
+      tryRule<1u<<3, (1u<<2)|(1u<<3)>(birth, survive, log, input, output)  // Life
+      || tryRule<(1u<<3)|(1u<<6), (1u<<2)|(1u<<3)>(birth, survive, log, input, output)  // HighLife
+      || tryRule<1u<<2, 0>(birth, survive, log, input, output)  // Seeds
+      || tryRule<(1u<<3)|(1u<<6)|(1u<<7)|(1u<<8), (1u<<3)|(1u<<4)|(1u<<6)|(1u<<7)|(1u<<8)>(birth, survive, log, input, output)  // Day & Night
+      || tryRule<1u<<3, 0x1FF>(birth, survive, log, input, output)  // Life without Death
+      || tryRule<1u<<3, 0x3E>(birth, survive, log, input, output);  // Maze
+    if(!found)
+      throw std::runtime_error("LifeProvider::ExecuteRule - rule '"+rule+"' is not compiled in.");
   }
 
 };
@@ -1,11 +1,92 @@
 #ifndef user_matrix_exponent_hpp
 #define user_matrix_exponent_hpp
 
+#include <algorithm>
+
 #include "puzzler/puzzles/matrix_exponent.hpp"
 
+#include "env_options.hpp"
+#include "mersenne31.hpp"
+
+//! Engine settings, defaulting to the PUZZLER_MATRIX_* environment variables
+struct MatrixExponentOptions
+{
+  //! "demand" only computes what the hashes depend on, "reference" does full products
+  std::string engine;
+
+  MatrixExponentOptions()
+    : engine(EnvOption("PUZZLER_MATRIX_ENGINE", std::string("demand")))
+  {}
+};
+
 class MatrixExponentProvider
   : public puzzler::MatrixExponentPuzzle
 {
+private:
+  MatrixExponentOptions m_options;
+
+  /*! Column 0 of MatrixCreate(n,seed), without the rest of the matrix.
+
+    Step is multiplication by 15807 mod 2^31-1, so going down a row
+    (n steps) is multiplication by 15807^n mod 2^31-1. That holds from
+    the first step on, even for a seed that is not yet reduced.
+  */
+  static std::vector<uint32_t> column0(unsigned n, uint32_t seed)
+  {
+    uint32_t jump=1;
+    for(unsigned i=0; i<n; i++){
+      jump=Mersenne31::Step(jump);
+    }
+    std::vector<uint32_t> col(n);
+    for(unsigned i=0; i<n; i++){
+      col[i]=seed;
+      seed=Mersenne31::MulMod(jump, seed);
+    }
+    return col;
+  }
+
+  /*! Hashes from only the entries of acc and A they depend on.
+
+    MatrixMul's inner product reads a[r*n+i] and b[i*n+r], so entry
+    (r,c) of a product depends on row r of acc and column r of A, and
+    not on c at all. The hash is acc[0], so the whole chain of products
+    needs just row 0 of acc and column 0 of A; row 0 of each product is
+    one n-term inner product, repeated across the row. That is O(n) per
+    step instead of O(n^3). Mersenne31::WrapDot gives the same result
+    as MatrixMul's chain of wrapping Mul and Add over the same operands,
+    without a divide per term.
+  */
+  void executeDemand(
+		     puzzler::ILog *log,
+		     const puzzler::MatrixExponentInput *input,
+		     puzzler::MatrixExponentOutput *output
+		     ) const
+  {
+    unsigned n=input->n;
+    std::vector<uint32_t> hash(input->steps);
+    if(hash.empty() || n==0){
+      output->hashes=hash;
+      return;
+    }
+
+    log->LogVerbose("Setting up column 0 of A and row 0 of identity");
+    std::vector<uint32_t> col=column0(n, input->seed);
+    std::vector<uint32_t> row(n, 0);
+    row[0]=1;
+
+    log->LogVerbose("Beginning multiplication");
+    hash[0]=row[0];
+    for(unsigned i=1; i<input->steps; i++){
+      log->LogDebug("Iteration %d", i);
+      uint32_t sum=Mersenne31::WrapDot(&row[0], &col[0], n);
+      std::fill(row.begin(), row.end(), sum);
+      hash[i]=sum;
+    }
+    log->LogVerbose("Done");
+
+    output->hashes=hash;
+  }
+
 public:
   MatrixExponentProvider()
   {}
@@ -15,7 +96,12 @@ public:
 		       const puzzler::MatrixExponentInput *input,
 		       puzzler::MatrixExponentOutput *output
 		       ) const override {
-    return ReferenceExecute(log, input, output);
+    if(m_options.engine=="reference"){
+      return ReferenceExecute(log, input, output);
+    }else if(m_options.engine=="demand"){
+      return executeDemand(log, input, output);
+    }
+    throw std::runtime_error("MatrixExponentProvider::Execute - unknown engine '"+m_options.engine+"'.");
   }
 
 };
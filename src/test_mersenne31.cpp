@@ -0,0 +1,145 @@
+#include "puzzler/puzzles/matrix_exponent.hpp"
+
+#include "mersenne31.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// The puzzle's own operations, which Mersenne31 has to match
+struct PuzzleOps
+  : puzzler::MatrixExponentPuzzle
+{
+   using puzzler::MatrixExponentPuzzle::Step;
+   using puzzler::MatrixExponentPuzzle::Mul;
+   using puzzler::MatrixExponentPuzzle::Add;
+};
+
+static const uint64_t P=Mersenne31::P;
+
+static unsigned tests=0, failures=0;
+
+static void check(bool ok, const char *what, uint64_t a, uint64_t b)
+{
+   tests++;
+   if(!ok){
+      if(failures<10){
+         fprintf(stderr, "test_mersenne31 - %s wrong for %llu, %llu\n", what, (unsigned long long)a, (unsigned long long)b);
+      }
+      failures++;
+   }
+}
+
+static void checkScalar(uint32_t a, uint32_t b, uint64_t x)
+{
+   check(Mersenne31::Reduce(x)==x%P, "Reduce", x, 0);
+   check(Mersenne31::Fold(x)%P==x%P, "Fold", x, 0);
+   check(Mersenne31::MulMod(a, b)==uint64_t(a)*b%P, "MulMod", a, b);
+   check(Mersenne31::Step(a)==PuzzleOps::Step(a), "Step", a, 0);
+}
+
+// Every Mersenne31Lanes operation, lane by lane against plain 64-bit arithmetic
+static void checkLanes(const uint32_t *a, const uint32_t *b, const uint64_t *x)
+{
+   uint64_t got[4];
+
+   Mersenne31Lanes la=Mersenne31Lanes::Load(a), lb=Mersenne31Lanes::Load(b), lx=Mersenne31Lanes::Load64(x);
+   la.Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==a[i], "Load", a[i], 0);
+   }
+   lx.Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==x[i], "Load64", x[i], 0);
+   }
+   Mersenne31Lanes::Zero().Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==0, "Zero", i, 0);
+   }
+   Mersenne31Lanes::Broadcast(a[0]).Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==a[0], "Broadcast", a[0], 0);
+   }
+   (lx+Mersenne31Lanes::Load64(x+4)).Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==x[i]+x[i+4], "operator+", x[i], x[i+4]);
+   }
+   Mersenne31Lanes::MulWide(la, lb).Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==uint64_t(a[i])*b[i], "MulWide", a[i], b[i]);
+   }
+   Mersenne31Lanes::MulWrap(la, lb).Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==uint32_t(a[i]*b[i]), "MulWrap", a[i], b[i]);
+   }
+   Mersenne31Lanes::Fold(lx).Store(got);
+   for(unsigned i=0; i<4; i++){
+      check(got[i]==Mersenne31::Fold(x[i]), "Fold (lanes)", x[i], 0);
+   }
+   // Lane sums would overflow in the reference if not reduced first
+   uint64_t sum=0;
+   for(unsigned i=0; i<4; i++){
+      sum+=x[i]%P;
+   }
+   check(lx.Reduce()==sum%P, "Reduce (lanes)", x[0], x[1]);
+}
+
+int main(int argc, char *argv[])
+{
+   std::mt19937_64 rng(argc>1 ? atoi(argv[1]) : 1);
+
+#if defined(__AVX2__)
+   fprintf(stderr, "test_mersenne31 - testing the AVX2 lanes\n");
+#elif defined(__SSE2__)
+   fprintf(stderr, "test_mersenne31 - testing the SSE2 lanes\n");
+#else
+   fprintf(stderr, "test_mersenne31 - testing the scalar lanes\n");
+#endif
+
+   // Around zero, p, 2^31, 2^32, and the square root of 2^32
+   const uint32_t edges[]={
+      0, 1, 2, 46341u, 65535u, 65536u, 2147483646u, 2147483647u, 2147483648u, 4294967294u, 4294967295u
+   };
+   const unsigned edgeCount=sizeof(edges)/sizeof(edges[0]);
+   for(unsigned i=0; i<edgeCount; i++){
+      for(unsigned j=0; j<edgeCount; j++){
+         checkScalar(edges[i], edges[j], uint64_t(edges[i])*edges[j]);
+      }
+   }
+   for(uint64_t x : {~uint64_t(0), ~uint64_t(0)-1, P*P, P*P-1, (P<<33)+P, uint64_t(1)<<62}){
+      checkScalar(0, 0, x);
+   }
+   for(unsigned i=0; i<1000000; i++){
+      checkScalar(uint32_t(rng()), uint32_t(rng()), rng());
+   }
+
+   uint32_t a[4], b[4];
+   uint64_t x[8];
+   for(unsigned i=0; i<100000; i++){
+      for(unsigned j=0; j<4; j++){
+         a[j]=i<edgeCount*edgeCount/4 ? edges[(4*i+j)%edgeCount] : uint32_t(rng());
+         b[j]=i<edgeCount*edgeCount/4 ? edges[(4*i+j)/edgeCount%edgeCount] : uint32_t(rng());
+      }
+      for(unsigned j=0; j<8; j++){
+         x[j]=rng()>>(rng()%64);
+      }
+      checkLanes(a, b, x);
+   }
+
+   // WrapDot against the puzzle's chain of Add and Mul, across the 8-way loop and its tail
+   std::vector<uint32_t> u(1000), v(1000);
+   for(unsigned i=0; i<u.size(); i++){
+      u[i]=i%7==0 ? edges[i%edgeCount] : uint32_t(rng());
+      v[i]=i%5==0 ? edges[i%edgeCount] : uint32_t(rng());
+   }
+   for(unsigned n=0; n<=u.size(); n+=n<20 ? 1 : 97){
+      uint32_t sum=0;
+      for(unsigned i=0; i<n; i++){
+         sum=PuzzleOps::Add(sum, PuzzleOps::Mul(u[i], v[i]));
+      }
+      check(Mersenne31::WrapDot(&u[0], &v[0], n)==sum, "WrapDot", n, 0);
+   }
+
+   fprintf(stderr, "test_mersenne31 - %u of %u tests passed\n", tests-failures, tests);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#include "mod_gemm.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+// Each entry as an exact 128-bit sum of 64-bit products, reduced once at the end
+static std::vector<uint32_t> naiveMultiply(unsigned m, unsigned n, unsigned k, const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+{
+   std::vector<uint32_t> c(uint64_t(m)*n);
+   for(unsigned r=0; r<m; r++){
+      for(unsigned j=0; j<n; j++){
+         unsigned __int128 sum=0;
+         for(unsigned i=0; i<k; i++){
+            sum+=uint64_t(a[uint64_t(r)*k+i])*b[uint64_t(i)*n+j];
+         }
+         c[uint64_t(r)*n+j]=uint32_t(sum%ModGemm::Modulus);
+      }
+   }
+   return c;
+}
+
+// Mostly random words, with a share of the values around p and 2^32 that reduction gets wrong
+static uint32_t entry(std::mt19937 &rng)
+{
+   switch(rng()%4){
+   case 0:  return 0xFFFFFFFFu-rng()%3;
+   case 1:  return ModGemm::Modulus-1+rng()%3;
+   default: return rng();
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   std::mt19937 rng(argc>1 ? atoi(argv[1]) : 1);
+
+   // Sizes that are and aren't multiples of the 4x4 tiles and of the blocks
+   const unsigned shapes[][3]={
+      {1,1,1}, {5,7,3}, {4,4,0}, {0,3,5}, {64,64,64}, {67,129,1030}, {130,3,600}
+   };
+   const unsigned blocks[][3]={
+      {1,1,1}, {5,6,15}, {64,64,512}
+   };
+
+   unsigned tests=0, failures=0;
+   for(unsigned threads : {1u, 3u}){
+      ThreadPool pool(threads);
+      for(const auto &shape : shapes){
+         unsigned m=shape[0], n=shape[1], k=shape[2];
+         std::vector<uint32_t> a(uint64_t(m)*k), b(uint64_t(k)*n);
+         for(auto &x : a){
+            x=entry(rng);
+         }
+         for(auto &x : b){
+            x=entry(rng);
+         }
+         std::vector<uint32_t> want=naiveMultiply(m, n, k, a, b);
+
+         for(const auto &block : blocks){
+            ModGemm gemm(block[0], block[1], block[2]);
+            tests++;
+            if(gemm.Multiply(pool, m, n, k, a, b)!=want){
+               fprintf(stderr, "test_mod_gemm - wrong product for %ux%u times %ux%u, blocks %u,%u,%u, %u threads\n",
+                       m, k, k, n, block[0], block[1], block[2], threads);
+               failures++;
+            }
+         }
+      }
+   }
+
+   ThreadPool pool(1);
+   try{
+      ModGemm().Multiply(pool, 2, 2, 2, std::vector<uint32_t>(3), std::vector<uint32_t>(4));
+      fprintf(stderr, "test_mod_gemm - inconsistent sizes were accepted\n");
+      failures++;
+   }catch(std::runtime_error &){
+   }
+   tests++;
+
+   fprintf(stderr, "test_mod_gemm - %u of %u tests passed\n", tests-failures, tests);
+   return failures ? 1 : 0;
+}